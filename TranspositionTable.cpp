@@ -2,6 +2,17 @@
 #include "TranspositionTable.h"
 #include <iostream>
 #include <string>
+#include <cstring>
+#include <climits>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <sys/mman.h>
+#endif
 
 using namespace std;
 
@@ -15,16 +26,114 @@ bool Transposition::IsQuiscence() {
 	return flag > 2;
 }
 
+// The bucket already comes from the high bits of the key (see bucket()) so only the low 16 bits are kept
+// to tell the positions sharing a bucket apart, the whole entry then fits in one 64 bit word:
+// |16 key| |16 move| |16 value| |8 depth| |4 generation| |3 flag| |1 used|
+// the used bit is there so an empty slot (all zeros) is never taken for an entry.
+static constexpr int MateBound = 30000, ValueLimit = 32767;
+
+// Mate scores sit right next to INT_MAX / INT_MIN + 1, they are stored as their distance from there
+// on top of the 16 bit bound and the normal scores are all well below that bound.
+static int16_t valueToTable(int value) {
+	if (value > 1e9) return int16_t(ValueLimit - min(INT_MAX - value, ValueLimit - MateBound));
+	if (value < -1e9) return int16_t(-ValueLimit + min(value - INT_MIN, ValueLimit - MateBound));
+	return int16_t(max(min(value, MateBound - 1), -MateBound + 1));
+}
+
+static int valueFromTable(int16_t value) {
+	if (value >= MateBound) return INT_MAX - (ValueLimit - value);
+	if (value <= -MateBound) return INT_MIN + (value + ValueLimit);
+	return value;
+}
+
+uint64_t Transposition::pack() {
+	return ((key & 65535) << 48) | (uint64_t(move.move) << 32) | (uint64_t(uint16_t(valueToTable(value))) << 16)
+		| (uint64_t(depth) << 8) | (uint64_t(generation & 15) << 4) | (uint64_t(flag & 7) << 1) | 1;
+}
+
+Transposition Transposition::unpack(uint64_t key, uint64_t data) {
+	Transposition trans;
+	trans.key = key;
+	trans.move.move = (data >> 32) & 65535;
+	trans.value = valueFromTable(int16_t(uint16_t(data >> 16)));
+	trans.depth = (data >> 8) & 255;
+	trans.generation = (data >> 4) & 15;
+	trans.flag = (data >> 1) & 7;
+	return trans;
+}
+
+void TableStats::add(TableStats& other) {
+	overwrites += other.overwrites;
+	collisions += other.collisions;
+}
+
 // Initializes the transposition table with the specified size.
 TranspositionTable::TranspositionTable(int sizeMB) {
 	initializePieceKeys();
-	tableSize = (sizeMB * 1024 * 1024) / sizeof(Transposition);
-	table.resize(tableSize);
+	resize(sizeMB);
+}
+
+TranspositionTable::~TranspositionTable() {
+	freeTable();
+}
+
+// The table memory comes straight from the operating system, its pages are page aligned (so every bucket sits
+// on one cache line) and they are only backed by zeroed memory the first time they are touched,
+// so a new table is already empty without writing to it. An all zero slot is an empty one.
+// On linux the table asks for 2 MB pages, explicitly reserved ones if there are any and otherwise
+// transparent huge pages, which saves a lot of TLB misses on a table this big.
+void TranspositionTable::resize(int sizeMB) {
+	freeTable();
+
+	bucketCount = (uint64_t(sizeMB) * 1024 * 1024) / sizeof(TableBucket);
+	allocatedBytes = bucketCount * sizeof(TableBucket);
+
+#if defined(_WIN32)
+	memory = VirtualAlloc(nullptr, allocatedBytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#elif defined(__linux__)
+	constexpr size_t hugePageSize = 2 * 1024 * 1024;
+	allocatedBytes = (allocatedBytes + hugePageSize - 1) / hugePageSize * hugePageSize;
+	memory = mmap(nullptr, allocatedBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (memory == MAP_FAILED) {
+		memory = mmap(nullptr, allocatedBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (memory != MAP_FAILED) madvise(memory, allocatedBytes, MADV_HUGEPAGE);
+	}
+	if (memory == MAP_FAILED) memory = nullptr;
+#else
+	// Anywhere else the memory is zeroed by calloc and aligned by hand.
+	memory = calloc(allocatedBytes + 63, 1);
+#endif
+
+	if (!memory) {
+		cerr << "Failed to allocate a transposition table of " << sizeMB << " MB" << endl;
+		exit(EXIT_FAILURE);
+	}
+
+	table = reinterpret_cast<TableBucket*>((reinterpret_cast<uintptr_t>(memory) + 63) & ~uintptr_t(63));
+	stats = TableStats();
+	generation = 0;
+}
+
+void TranspositionTable::freeTable() {
+	if (!memory) return;
+#if defined(_WIN32)
+	VirtualFree(memory, 0, MEM_RELEASE);
+#elif defined(__linux__)
+	munmap(memory, allocatedBytes);
+#else
+	free(memory);
+#endif
+	memory = nullptr;
+	table = nullptr;
 }
 
 // Initialize the zobrist keys used in hashing the transpositions.
 void TranspositionTable::initializePieceKeys() {
 	blackToMove = randomGenerator.generate64Bits();
+	for (int i = 0; i < 16; i++)
+		castlingKeys[i] = randomGenerator.generate64Bits();
+	for (int i = 0; i < 8; i++)
+		enPassantKeys[i] = randomGenerator.generate64Bits();
 	for (int i = 0; i < 2; i++) 
 		for (int j = 0; j < 7; j++) 
 			for (int k = 0; k < 8; k++) 
@@ -32,80 +141,113 @@ void TranspositionTable::initializePieceKeys() {
 					pieceKeys[i][j][k][l] = randomGenerator.generate64Bits();
 }
 
-void TranspositionTable::storeTransposition(uint64_t key, uint8_t flag, uint8_t depth, int value, Move move) {
-	int hash = key % tableSize;
+// Reads a slot, returns false when it's empty or holds another position.
+static bool readSlot(TableSlot& slot, uint64_t key, Transposition& trans) {
+	uint64_t data = slot.data.load(memory_order_relaxed);
+	if (data == 0 || (data >> 48) != (key & 65535)) return false;
+	trans = Transposition::unpack(key, data);
+	return true;
+}
 
-	// Clear the table if it's full.
-	if (getFillPercentage() > 99)
-		clear();
+static void writeSlot(TableSlot& slot, Transposition trans) {
+	slot.data.store(trans.pack(), memory_order_relaxed);
+}
 
-	// First time for this hash.
-	if (table[hash].key == 0) {
-		entriesCount++;
-		table[hash] = { key, flag, depth, move, value };
-	}
-	else { // The entry exists in the table.
-		int originalHash = hash;
+// Maps the key to a bucket by multiplying it with the bucket count and keeping the high 64 bits of the product
+// (the same as (key / 2^64) * bucketCount), this works for any table size and is much cheaper than a modulo.
+TableBucket& TranspositionTable::bucket(uint64_t key) {
+#if defined(_MSC_VER)
+	return table[__umulh(key, bucketCount)];
+#else
+	return table[uint64_t((unsigned __int128)key * bucketCount >> 64)];
+#endif
+}
 
-		// Search linearly for the key.
-		while (table[hash].key != 0 && table[hash].key != key) {
-			hash = (hash + 1) % tableSize;
+// Starts loading the bucket of a position into the cache, called as soon as the key of a child position
+// is known so the memory access overlaps with the work done before the child probes the table.
+void TranspositionTable::prefetch(uint64_t key) {
+#if defined(_MSC_VER)
+	_mm_prefetch(reinterpret_cast<const char*>(&bucket(key)), _MM_HINT_T0);
+#else
+	__builtin_prefetch(&bucket(key));
+#endif
+}
 
-			// Table is full.
-			if (hash == originalHash) return;
-		}
+// Called once at the start of every search so the entries of the previous searches age.
+void TranspositionTable::newSearch() {
+	generation = (generation + 1) % GenerationCycle;
+}
 
-		if (hash != originalHash) collisions++;
+// How much an entry is worth keeping, quiescence depths count from a different end so they
+// are worth the least and every search that passed since the entry was stored costs it 8 plies.
+static int replacementValue(Transposition& trans, uint8_t generation) {
+	int age = (generation - trans.generation + TranspositionTable::GenerationCycle) % TranspositionTable::GenerationCycle;
+	int depth = trans.IsQuiscence() ? 0 : trans.depth;
+	return depth - 8 * age;
+}
 
-		if (table[hash].key == 0) {
-			entriesCount++;
-			table[hash] = { key, flag, depth, move, value };
-		}
-		else {
-
-			bool isQuiescence = flag > 2;
-			bool storedIsQuiescence = table[hash].flag > 2;
-
-			// overwrite if better depth and the search type is equal, meaning The stored value was stored during main search
-			// and the current search is also the main search and same for quiescence.
-			bool betterDepth = table[hash].depth < depth && (storedIsQuiescence == isQuiescence);
-			// replacing upper and lower bound evaluations with exact ones.
-			bool exactEvaluation = (depth >= table[hash].depth && flag == Transposition::Exact);
-			// replaces values stored during quiescence search with a value from the main search.
-			bool replaceQuiescence = storedIsQuiescence && !isQuiescence;
-
-			if (betterDepth || exactEvaluation || replaceQuiescence) {
-				overwrites++;
-				table[hash] = { key, flag, depth, move, value };
-			}
+void TranspositionTable::storeTransposition(uint64_t key, uint8_t flag, uint8_t depth, int value, Move move, TableStats& threadStats) {
+	TableBucket& b = bucket(key);
+	Transposition newEntry = { key, flag, depth, move, value, generation };
+
+	// The slot already holding this position is updated in place.
+	Transposition stored;
+	for (int i = 0; i < TableBucket::Size; i++) {
+		if (!readSlot(b.slots[i], key, stored)) continue;
+
+		bool isQuiescence = flag > 2;
+		bool storedIsQuiescence = stored.flag > 2;
+
+		// overwrite if better depth and the search type is equal, meaning The stored value was stored during main search
+		// and the current search is also the main search and same for quiescence.
+		bool betterDepth = stored.depth < depth && (storedIsQuiescence == isQuiescence);
+		// replacing upper and lower bound evaluations with exact ones.
+		bool exactEvaluation = (depth >= stored.depth && flag == Transposition::Exact);
+		// replaces values stored during quiescence search with a value from the main search.
+		bool replaceQuiescence = storedIsQuiescence && !isQuiescence;
+		// An entry left by an older search is refreshed.
+		bool olderSearch = stored.generation != generation;
+
+		if (betterDepth || exactEvaluation || replaceQuiescence || olderSearch) {
+			threadStats.overwrites++;
+			writeSlot(b.slots[i], newEntry);
 		}
+		return;
+	}
+
+	// Otherwise an empty slot is used or the entry worth the least is replaced.
+	int victim = 0, victimValue = INT_MAX;
+	for (int i = 0; i < TableBucket::Size; i++) {
+		uint64_t data = b.slots[i].data.load(memory_order_relaxed);
+		if (data == 0) { victim = i; break; }
 
+		Transposition trans = Transposition::unpack(0, data);
+		int value = replacementValue(trans, generation);
+		if (value < victimValue) {
+			victim = i;
+			victimValue = value;
+		}
 	}
 
-	
+	if (b.slots[victim].data.load(memory_order_relaxed) != 0) threadStats.collisions++;
+	writeSlot(b.slots[victim], newEntry);
 }
 
 // Checks if the transposition exists in the table.
 bool TranspositionTable::probeTransposition(uint64_t key, Transposition& trans) {
-	int hash = key % tableSize;
-	int originalHash = hash;
-	while (table[hash].key != 0) {
-		if (table[hash].key == key) {
-			trans = table[hash];
-			return true;
-		}
-		
-		hash = (hash + 1) % tableSize;
-
-		if (hash == originalHash) return false;
-		
+	TableBucket& b = bucket(key);
+	for (int i = 0; i < TableBucket::Size; i++) {
+		if (readSlot(b.slots[i], key, trans)) return true;
 	}
 	return false;
 }
 
-int TranspositionTable::lookupEvaluation(uint64_t key, int depth, int alpha, int beta, bool& found, bool Quiescence) {
+// Also hands back the stored best move in ttMove (or an empty move) so it can be searched first when there's no cut-off.
+int TranspositionTable::lookupEvaluation(uint64_t key, int depth, int alpha, int beta, bool& found, bool Quiescence, Move& ttMove) {
 	Transposition pos;
+	ttMove = Move();
 	if (probeTransposition(key, pos)) {
+		ttMove = pos.move;
 		if (pos.IsQuiscence() == Quiescence && pos.depth >= depth || (!pos.IsQuiscence() && Quiescence)) {
 			if (pos.flag == pos.Exact || pos.flag == pos.QExact) {
 				found = true;
@@ -127,6 +269,12 @@ int TranspositionTable::lookupEvaluation(uint64_t key, int depth, int alpha, int
 }
 
 
+// The key of a position searched without one of its moves, the move is spread over all the bits
+// so the entry doesn't land on the entry of the normal search of the position.
+uint64_t TranspositionTable::excludedMoveKey(uint64_t key, Move excluded) {
+	return key ^ (uint64_t(excluded.move) * 0x9E3779B97F4A7C15ULL);
+}
+
 uint64_t TranspositionTable::generateZobristKey(int board[8][8]) {
 	uint64_t key = 0;
 	for (int i = 0; i < 8; i++) {
@@ -144,22 +292,56 @@ uint64_t TranspositionTable::generateZobristKey(int board[8][8]) {
 	return key;
 }
 
+// The part of the key coming from the castling rights and the en passant square of a game state.
+uint64_t TranspositionTable::gameStateKey(uint16_t gameState) {
+	uint64_t key = castlingKeys[gameState & 15];
+	// The en passant row is never 0 so a non zero row means there is an en passant square.
+	if ((gameState >> 4) & 7) key ^= enPassantKeys[(gameState >> 7) & 7];
+	return key;
+}
+
 string TranspositionTable::getFillData() {
 	string output = "";
-	output += "Table Occupancy: " + to_string(entriesCount) + " : " + to_string((double(entriesCount) / double(tableSize)) * 100) + " %" + '\n';
-	output += "Table Overwrites:  " + to_string(overwrites) + '\n';
-	output += "Table Collisions:  " + to_string(collisions) + '\n';
+	output += "Table Occupancy: " + to_string(getFillPercentage()) + " %" + '\n';
+	output += "Table Overwrites:  " + to_string(stats.overwrites) + '\n';
+	output += "Table Collisions:  " + to_string(stats.collisions) + '\n';
 	return output;
 }
 
+// The permille of the table used by the current search (the uci hashfull value), only the first
+// thousand buckets are looked at since the keys spread evenly over the table.
+int TranspositionTable::hashfull() {
+	int sampled = (int)min<uint64_t>(bucketCount, 1000), used = 0;
+	for (int i = 0; i < sampled; i++) {
+		for (int j = 0; j < TableBucket::Size; j++) {
+			uint64_t data = table[i].slots[j].data.load(memory_order_relaxed);
+			if (data != 0 && Transposition::unpack(0, data).generation == generation) used++;
+		}
+	}
+	return used * 1000 / (sampled * TableBucket::Size);
+}
+
 double TranspositionTable::getFillPercentage() {
-	return (double(entriesCount) / double(tableSize)) * 100;
+	return hashfull() / 10.0;
 }
 
-void TranspositionTable::clear() {
-	for (int i = 0; i < table.size(); i++) {
-		table[i] = Transposition();
+// Every thread zeroes its own part of the table, touching the pages from several threads is a lot
+// faster than one memset on a big table.
+void TranspositionTable::clear(int threads) {
+	threads = max(threads, 1);
+	uint64_t bucketsPerThread = (bucketCount + threads - 1) / threads;
+	vector<thread> workers;
+
+	for (int i = 0; i < threads; i++) {
+		uint64_t start = i * bucketsPerThread;
+		if (start >= bucketCount) break;
+		uint64_t count = min(bucketsPerThread, bucketCount - start);
+		workers.emplace_back([this, start, count]() {
+			memset(static_cast<void*>(table + start), 0, count * sizeof(TableBucket));
+		});
 	}
+	for (thread& worker : workers) worker.join();
 
-	overwrites = 0, collisions = 0, entriesCount = 0;
+	stats = TableStats();
+	generation = 0;
 }
\ No newline at end of file
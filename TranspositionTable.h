@@ -1,5 +1,9 @@
 #pragma once
 #include <random>
+#include <atomic>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
 #include "dataStructures.h"
 #include "move.h"
 
@@ -34,9 +38,33 @@ struct Transposition {
 	uint8_t depth; // Depth of the search
 	Move move;
 	int value; // Evaluation score
+	uint8_t generation = 0; // The search that stored it, used to replace entries from older searches first.
 
 
 	bool IsQuiscence();
+	uint64_t pack();
+	static Transposition unpack(uint64_t key, uint64_t data);
+};
+
+// Every slot is a whole entry packed in one 64 bit word that is read and written atomically,
+// so two threads writing the same slot at the same time can never leave half of each entry behind.
+struct TableSlot {
+	atomic<uint64_t> data{ 0 };
+};
+
+// The slots are grouped in buckets of one 64 byte cache line, a position can only be stored in the bucket
+// its key maps to so a probe reads one cache line at most.
+struct alignas(64) TableBucket {
+	static constexpr int Size = 8;
+
+	TableSlot slots[Size];
+};
+
+// Counters every search thread keeps for itself, they are added together once the threads are done.
+struct TableStats {
+	int overwrites = 0, collisions = 0;
+
+	void add(TableStats& other);
 };
 
 struct TranspositionTable {
@@ -45,17 +73,35 @@ private:
 public:
 	uint64_t pieceKeys[2][7][8][8];
 	uint64_t blackToMove;
-	myVector<Transposition> table;
-	int tableSize;
-	int entriesCount = 0, overwrites = 0, collisions = 0;
+	// Positions with the same pieces but different castling rights or en passant file are different positions.
+	uint64_t castlingKeys[16];
+	uint64_t enPassantKeys[8];
+	// The generation is only 4 bits in the packed entry so it wraps around every 16 searches.
+	static constexpr int GenerationCycle = 16;
+
+	TableBucket* table = nullptr;
+	void* memory = nullptr;
+	size_t allocatedBytes = 0;
+	uint64_t bucketCount = 0;
+	uint8_t generation = 0;
+	TableStats stats;
 
 	TranspositionTable(int sizeMB);
+	~TranspositionTable();
+	void resize(int sizeMB);
+	void freeTable();
 	void initializePieceKeys();
-	void storeTransposition(uint64_t key, uint8_t flag, uint8_t depth, int value, Move move);
+	void storeTransposition(uint64_t key, uint8_t flag, uint8_t depth, int value, Move move, TableStats& threadStats);
 	bool probeTransposition(uint64_t key, Transposition& trans);
-	int lookupEvaluation(uint64_t key, int depth, int alpha, int beta, bool& found, bool Quiescence);
+	TableBucket& bucket(uint64_t key);
+	void newSearch();
+	int hashfull();
+	void prefetch(uint64_t key);
+	int lookupEvaluation(uint64_t key, int depth, int alpha, int beta, bool& found, bool Quiescence, Move& ttMove);
 	string getFillData();
 	double getFillPercentage();
-	void clear();
+	void clear(int threads = 1);
 	uint64_t generateZobristKey(int board[8][8]);
+	uint64_t gameStateKey(uint16_t gameState);
+	uint64_t excludedMoveKey(uint64_t key, Move excluded);
 };
\ No newline at end of file
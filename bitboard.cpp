@@ -0,0 +1,169 @@
+#pragma once
+#include "bitboard.h"
+
+Bitboard knightAttacks[64];
+Bitboard kingAttacks[64];
+Bitboard pawnAttacks[2][64];
+Bitboard rays[8][64];
+// The squares strictly between two squares on the same line and the whole line going through them,
+// both are empty when the squares don't share a rank, file or diagonal.
+Bitboard betweenBB[64][64];
+Bitboard lineBB[64][64];
+Magic rookMagics[64];
+Magic bishopMagics[64];
+
+// Every square gets a block of 2^(mask bits) entries, rooks need 102400 entries in total and bishops 5248.
+static Bitboard rookTable[102400];
+static Bitboard bishopTable[5248];
+
+static bool onBoard(int x, int y) {
+    return x >= 0 && y >= 0 && x < 8 && y < 8;
+}
+
+// Attacks along one ray stopping at (and including) the first blocker,
+// the blocker is the nearest set bit which is the lowest bit for the first four directions.
+// This is only used to fill the attack tables.
+static Bitboard rayAttacks(int dir, int sq, Bitboard occupied) {
+    Bitboard attacks = rays[dir][sq];
+    Bitboard blockers = attacks & occupied;
+    if (blockers) {
+        int blocker = (dir < 4) ? lsb(blockers) : msb(blockers);
+        attacks ^= rays[dir][blocker];
+    }
+    return attacks;
+}
+
+static Bitboard slidingAttacks(const int directions[4], int sq, Bitboard occupied) {
+    Bitboard attacks = 0;
+    for (int i = 0; i < 4; i++)
+        attacks |= rayAttacks(directions[i], sq, occupied);
+    return attacks;
+}
+
+// A small xorshift generator, it's reseeded for every row with seeds that find
+// magics quickly (the ones Stockfish uses) so the same magics are found on every run.
+static constexpr uint64_t magicSeeds[8] = { 728, 10316, 55013, 32803, 12281, 15100, 16645, 255 };
+static uint64_t magicSeed;
+static uint64_t randomMagic() {
+    magicSeed ^= magicSeed >> 12;
+    magicSeed ^= magicSeed << 25;
+    magicSeed ^= magicSeed >> 27;
+    return magicSeed * 2685821657736338717ULL;
+}
+
+// Fills the attack table of a slider for every square, when pext is not available it also
+// searches for a magic number that maps every occupancy of the mask to an index without
+// destructive collisions (two occupancies sharing an index must have the same attacks).
+static void initMagics(Magic magics[64], Bitboard* table, const int directions[4]) {
+    Bitboard occupancies[4096], reference[4096];
+    int epoch[4096] = {}, attempt = 0;
+
+    for (int sq = 0; sq < 64; sq++) {
+        Magic& m = magics[sq];
+
+        // The last square of every ray doesn't change the attacks so it's left out of the mask.
+        m.mask = 0;
+        for (int i = 0; i < 4; i++) {
+            Bitboard ray = rays[directions[i]][sq];
+            if (ray) ray ^= squareBB((directions[i] < 4) ? msb(ray) : lsb(ray));
+            m.mask |= ray;
+        }
+
+        int bits = popCount(m.mask);
+        m.shift = 64 - bits;
+        m.attacks = (sq == 0) ? table : magics[sq - 1].attacks + (1 << (64 - magics[sq - 1].shift));
+
+        // Enumerates every subset of the mask (Carry-Rippler trick).
+        int size = 0;
+        Bitboard subset = 0;
+        do {
+            occupancies[size] = subset;
+            reference[size] = slidingAttacks(directions, sq, subset);
+            size++;
+            subset = (subset - m.mask) & m.mask;
+        } while (subset);
+
+#if defined(USE_PEXT)
+        for (int i = 0; i < size; i++)
+            m.attacks[m.index(occupancies[i])] = reference[i];
+#else
+        magicSeed = magicSeeds[sq >> 3];
+
+        // The epoch marks which table entries were written during the current attempt
+        // so the table doesn't need to be cleared between attempts.
+        for (int i = 0; i < size;) {
+            m.magic = 0;
+            while (popCount((m.mask * m.magic) >> 56) < 6)
+                m.magic = randomMagic() & randomMagic() & randomMagic();
+
+            attempt++;
+            for (i = 0; i < size; i++) {
+                unsigned index = m.index(occupancies[i]);
+                if (epoch[index] < attempt) {
+                    epoch[index] = attempt;
+                    m.attacks[index] = reference[i];
+                }
+                else if (m.attacks[index] != reference[i]) break;
+            }
+        }
+#endif
+    }
+}
+
+// Precomputes the attacks of the leaping pieces, the empty board rays and the sliding attack tables for every square
+// so move generation and attack detection become a few table lookups instead of board walks.
+void initBitboards() {
+    int knight_x_offsets[] = { -2, -1, -2, -1, 1, 1, 2, 2 };
+    int knight_y_offsets[] = { 1, 2, -1, -2, -2, 2, -1, 1 };
+    int king_x_offsets[] = { 1, 1, 1, -1, -1, -1, 0, 0 };
+    int king_y_offsets[] = { -1, 0, 1, -1, 0, 1, 1, -1 };
+    // Offsets ordered the same way as the ray directions in bitboard.h.
+    int ray_x_offsets[] = { 0, 1, 1, 1, 0, -1, -1, -1 };
+    int ray_y_offsets[] = { 1, 0, 1, -1, -1, 0, -1, 1 };
+
+    for (int x = 0; x < 8; x++) {
+        for (int y = 0; y < 8; y++) {
+            int sq = square(x, y);
+            knightAttacks[sq] = kingAttacks[sq] = 0;
+            pawnAttacks[WhiteIndex][sq] = pawnAttacks[BlackIndex][sq] = 0;
+
+            for (int i = 0; i < 8; i++) {
+                if (onBoard(x + knight_x_offsets[i], y + knight_y_offsets[i]))
+                    knightAttacks[sq] |= squareBB(square(x + knight_x_offsets[i], y + knight_y_offsets[i]));
+                if (onBoard(x + king_x_offsets[i], y + king_y_offsets[i]))
+                    kingAttacks[sq] |= squareBB(square(x + king_x_offsets[i], y + king_y_offsets[i]));
+            }
+
+            // White pawns move towards row 0 and black pawns towards row 7.
+            for (int dy = -1; dy <= 1; dy += 2) {
+                if (onBoard(x - 1, y + dy)) pawnAttacks[WhiteIndex][sq] |= squareBB(square(x - 1, y + dy));
+                if (onBoard(x + 1, y + dy)) pawnAttacks[BlackIndex][sq] |= squareBB(square(x + 1, y + dy));
+            }
+
+            for (int dir = 0; dir < 8; dir++) {
+                rays[dir][sq] = 0;
+                int tx = x + ray_x_offsets[dir], ty = y + ray_y_offsets[dir];
+                while (onBoard(tx, ty)) {
+                    rays[dir][sq] |= squareBB(square(tx, ty));
+                    tx += ray_x_offsets[dir]; ty += ray_y_offsets[dir];
+                }
+            }
+        }
+    }
+
+    for (int sq = 0; sq < 64; sq++) {
+        for (int dir = 0; dir < 8; dir++) {
+            Bitboard ray = rays[dir][sq];
+            while (ray) {
+                int target = popLsb(ray);
+                betweenBB[sq][target] = rays[dir][sq] ^ rays[dir][target] ^ squareBB(target);
+                lineBB[sq][target] = rays[dir][sq] | rays[(dir + 4) % 8][sq] | squareBB(sq);
+            }
+        }
+    }
+
+    int rookDirections[] = { East, South, West, North };
+    int bishopDirections[] = { SouthEast, SouthWest, NorthWest, NorthEast };
+    initMagics(rookMagics, rookTable, rookDirections);
+    initMagics(bishopMagics, bishopTable, bishopDirections);
+}
@@ -0,0 +1,140 @@
+#pragma once
+#include <cstdint>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+// Defining USE_PEXT at build time indexes the sliding attack tables with the BMI2 pext instruction
+// instead of magic multiplication, only use it on cpus that have fast pext (Intel Haswell / AMD Zen 3 and later).
+#if defined(USE_PEXT)
+#include <immintrin.h>
+#endif
+
+// A bitboard is a 64 bit number where every bit represents a square of the board.
+// Squares are numbered the same way the board array is indexed (square = x * 8 + y)
+// so bit 0 is a8, bit 7 is h8 and bit 63 is h1.
+typedef uint64_t Bitboard;
+
+// Colors used to index the bitboards, they match the first index of the zobrist piece keys.
+static constexpr int WhiteIndex = 0;
+static constexpr int BlackIndex = 1;
+
+// Used as a template parameter to specialize code on the side to move at compile time.
+enum Color { White = WhiteIndex, Black = BlackIndex };
+
+// Ray directions, the first four move towards higher square numbers and the last four towards lower ones.
+//// 0 -> East, 1 -> South, 2 -> South East, 3 -> South West
+//// 4 -> West, 5 -> North, 6 -> North West, 7 -> North East
+static constexpr int East = 0, South = 1, SouthEast = 2, SouthWest = 3;
+static constexpr int West = 4, North = 5, NorthWest = 6, NorthEast = 7;
+
+// The attacks of a sliding piece from a square only depend on the pieces standing on its rays (the mask),
+// each possible occupancy of the mask is mapped to an index into a precomputed attack table either by
+// a magic multiplication or by pext which packs the masked bits together.
+struct Magic {
+    Bitboard mask;
+    Bitboard magic;
+    Bitboard* attacks;
+    int shift;
+
+    unsigned index(Bitboard occupied) const {
+#if defined(USE_PEXT)
+        return (unsigned)_pext_u64(occupied, mask);
+#else
+        return (unsigned)(((occupied & mask) * magic) >> shift);
+#endif
+    }
+};
+
+extern Bitboard knightAttacks[64];
+extern Bitboard kingAttacks[64];
+extern Bitboard pawnAttacks[2][64];
+extern Bitboard rays[8][64];
+extern Bitboard betweenBB[64][64];
+extern Bitboard lineBB[64][64];
+extern Magic rookMagics[64];
+extern Magic bishopMagics[64];
+
+void initBitboards();
+
+inline int square(int x, int y) {
+    return x * 8 + y;
+}
+
+inline Bitboard squareBB(int sq) {
+    return 1ULL << sq;
+}
+
+inline int colorIndex(int team) {
+    return (team == 1) ? WhiteIndex : BlackIndex;
+}
+
+inline int popCount(Bitboard b) {
+#if defined(_MSC_VER)
+    return (int)__popcnt64(b);
+#else
+    return __builtin_popcountll(b);
+#endif
+}
+
+// Index of the least significant set bit, the bitboard must not be empty.
+inline int lsb(Bitboard b) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward64(&index, b);
+    return (int)index;
+#else
+    return __builtin_ctzll(b);
+#endif
+}
+
+// Index of the most significant set bit, the bitboard must not be empty.
+inline int msb(Bitboard b) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanReverse64(&index, b);
+    return (int)index;
+#else
+    return 63 ^ __builtin_clzll(b);
+#endif
+}
+
+// Returns the least significant square and removes it from the bitboard,
+// used to loop over the pieces in a bitboard one by one.
+inline int popLsb(Bitboard& b) {
+    int sq = lsb(b);
+    b &= b - 1;
+    return sq;
+}
+
+inline Bitboard rookAttacks(int sq, Bitboard occupied) {
+    const Magic& m = rookMagics[sq];
+    return m.attacks[m.index(occupied)];
+}
+
+inline Bitboard bishopAttacks(int sq, Bitboard occupied) {
+    const Magic& m = bishopMagics[sq];
+    return m.attacks[m.index(occupied)];
+}
+
+inline Bitboard queenAttacks(int sq, Bitboard occupied) {
+    return rookAttacks(sq, occupied) | bishopAttacks(sq, occupied);
+}
+
+// The attacks of a knight, bishop, rook or queen (by piece type) picked at compile time.
+template<int Type> Bitboard pieceAttacks(int sq, Bitboard occupied);
+
+template<> inline Bitboard pieceAttacks<2>(int sq, Bitboard occupied) {
+    return queenAttacks(sq, occupied);
+}
+
+template<> inline Bitboard pieceAttacks<3>(int sq, Bitboard occupied) {
+    return rookAttacks(sq, occupied);
+}
+
+template<> inline Bitboard pieceAttacks<4>(int sq, Bitboard /*occupied*/) {
+    return knightAttacks[sq];
+}
+
+template<> inline Bitboard pieceAttacks<5>(int sq, Bitboard occupied) {
+    return bishopAttacks(sq, occupied);
+}
@@ -2,7 +2,12 @@
 #include <iostream>
 #include <string>
 #include <chrono>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include <cmath>
 #include "pcsq.h"
+#include "bitboard.h"
 #include "dataStructures.h"
 #include "TranspositionTable.h"
 #include "move.h"
@@ -37,6 +42,29 @@ string to_algebraic(int from_x, int from_y, int target_x, int target_y) {
     return s;
 }
 
+// The uci string of a move, promotions are always to a queen.
+string moveToUci(Move move) {
+    // UCI's null move, sent as the best move when there's no legal move.
+    if (move.move == 0) return "0000";
+    string uci = to_algebraic(move.FromX(), move.FromY(), move.ToX(), move.ToY());
+    if (move.IsPromotion()) uci += 'q';
+    return uci;
+}
+
+// Reads a whole string as a number, returns false (leaving value alone) if it isn't one.
+bool parseNumber(string text, long long& value) {
+    try {
+        size_t length = 0;
+        long long number = stoll(text, &length);
+        if (length != text.size()) return false;
+        value = number;
+        return true;
+    }
+    catch (exception&) {
+        return false;
+    }
+}
+
 // This does the opposite of the above and turns two chars (the first or second part of uci)
 // to indices to be used inside of the board ex: a7 -> 1 0
 myPair<int, int> to_index(char file, char rank) {
@@ -74,6 +102,8 @@ void GameState::initialize_board(TranspositionTable& Ttable) {
     white_king = { 7,4 };
     memset(board, 0, sizeof(board));
     currentGameState = 0b0000000000001111;;
+    halfmoveClock = 0, fullmoveNumber = 1;
+    gameStateHistory.clear(), zobristKeys.clear(), halfmoveClocks.clear();
 
     // Initializing the new board to standard beginning chess position.
     int z = 0;
@@ -92,25 +122,30 @@ void GameState::initialize_board(TranspositionTable& Ttable) {
     board[0][3] = -2;  board[7][3] = 2; // queens
     board[0][4] = -1; board[7][4] = 1; // kings
 
+    initialize_bitboards();
+
     table = &Ttable;
-    zobristKey = table->generateZobristKey(board);
+    zobristKey = table->generateZobristKey(board) ^ table->gameStateKey(currentGameState);
 }
 
 // A constructor that allows us to copy any board fen strings from the internet 
 // and initialize the board to that state.
 void GameState::initialize_board(TranspositionTable& Ttable, string FEN) {
-    string board_fen = "", player_fen = "", castling_fen = "", en_passant_fen = "";
+    string board_fen = "", player_fen = "", castling_fen = "", en_passant_fen = "", halfmove_fen = "", fullmove_fen = "";
     int num_break = 0;
 
     currentGameState = 0;
+    gameStateHistory.clear(), zobristKeys.clear(), halfmoveClocks.clear();
 
-    // Parses the fen into four strings.
+    // Parses the fen into six strings, the move counters are optional.
     for (int i = 0; i < FEN.size(); i++) {
         if (FEN[i] == ' ') { num_break++; continue; }
         if (num_break == 0) board_fen.push_back(FEN[i]);
         else if (num_break == 1) player_fen.push_back(FEN[i]);
         else if (num_break == 2) castling_fen.push_back(FEN[i]);
         else if (num_break == 3) en_passant_fen.push_back(FEN[i]);
+        else if (num_break == 4) halfmove_fen.push_back(FEN[i]);
+        else if (num_break == 5) fullmove_fen.push_back(FEN[i]);
         else break;
     }
 
@@ -156,127 +191,201 @@ void GameState::initialize_board(TranspositionTable& Ttable, string FEN) {
         currentGameState |= (file << 7);
     }
 
+    // Missing or broken move counters fall back to the ones of a new game.
+    long long halfmoves = 0, fullmoves = 1;
+    parseNumber(halfmove_fen, halfmoves);
+    parseNumber(fullmove_fen, fullmoves);
+    halfmoveClock = int(min(max(halfmoves, 0LL), 1000LL));
+    fullmoveNumber = int(min(max(fullmoves, 1LL), 100000LL));
+
+    initialize_bitboards();
+
     table = &Ttable;
-    zobristKey = table->generateZobristKey(board);
+    zobristKey = table->generateZobristKey(board) ^ table->gameStateKey(currentGameState);
 
     if (player == -1) zobristKey ^= table->blackToMove;
 }
 
-// The following functions all Generate pseudo-legal moves for the pieces and push it to the object's move vector.
+// Rebuilds the bitboards from the board array, used after the board was filled directly.
+void GameState::initialize_bitboards() {
+    memset(pieceBitboards, 0, sizeof(pieceBitboards));
+    occupied = 0;
 
-// Generate pseudo-legal moves for the pawn.
-void GameState::pawn_moves(int x, int y, int team) {
-    myPair<int, int> enPassantSq = enPassant();
-    uint16_t flag = Move::None;
-
-    if (team == 1) {
+    for (int i = 0; i < 8; i++) {
+        for (int j = 0; j < 8; j++) {
+            int piece = board[i][j];
+            if (piece == 0) continue;
+            Bitboard bit = squareBB(square(i, j));
+            int color = colorIndex(piece > 0 ? 1 : -1);
+            pieceBitboards[color][abs(piece)] |= bit;
+            pieceBitboards[color][0] |= bit;
+            occupied |= bit;
+        }
+    }
+}
 
-        if (x - 1 == 0) flag = Move::Promotion;
+// The following functions change the board and the bitboards together so they never get out of sync.
 
-        if (in_board(x - 1, y) && board[x - 1][y] == 0){ // Moving once.
-            Move move(x, y, x - 1, y, flag);
-            if (check_legal(move))
-                white_possible_moves.push_back(move);
-        }
-        if (in_board(x - 2, y) && board[x - 2][y] == 0 && board[x - 1][y] == 0 && x == 6) { // Moving twice.
-            Move move(x, y, x - 2, y, Move::PawnTwoMoves);
-            if (check_legal(move))
-                white_possible_moves.push_back(move);
-        }
+// Places a piece on an empty square.
+void GameState::putPiece(int x, int y, int piece) {
+    Bitboard bit = squareBB(square(x, y));
+    int color = (piece > 0) ? WhiteIndex : BlackIndex;
+    board[x][y] = piece;
+    pieceBitboards[color][abs(piece)] |= bit;
+    pieceBitboards[color][0] |= bit;
+    occupied |= bit;
+}
 
-        if (in_board(x - 1, y - 1) && board[x - 1][y - 1] < 0) {
-            Move move(x, y, x - 1, y - 1, flag, true);
-            if (check_legal(move))       // Diagonal piece capturing.
-                white_possible_moves.push_back(move);
-        }
-        if (in_board(x - 1, y + 1) && board[x - 1][y + 1] < 0) {
-            Move move(x, y, x - 1, y + 1, flag, true);
-            if (check_legal(move))
-                white_possible_moves.push_back(move);
-        }
+// Removes whatever piece is on the square.
+void GameState::removePiece(int x, int y) {
+    int piece = board[x][y];
+    if (piece == 0) return;
+    Bitboard bit = squareBB(square(x, y));
+    int color = (piece > 0) ? WhiteIndex : BlackIndex;
+    board[x][y] = 0;
+    pieceBitboards[color][abs(piece)] &= ~bit;
+    pieceBitboards[color][0] &= ~bit;
+    occupied &= ~bit;
+}
 
-        if ((enPassantSq.first != 0 || enPassantSq.second != 0) && enPassantSq.first == 2) {
-            if (enPassantSq.first == x - 1 && enPassantSq.second == y - 1) {
-                Move move(x, y, x - 1, y - 1, Move::EnPassant, true); // En passant
-                if (check_legal(move))
-                    white_possible_moves.push_back(move);  
-            }
-            if (enPassantSq.first == x - 1 && enPassantSq.second == y + 1) {
-                Move move(x, y, x - 1, y + 1, Move::EnPassant, true);
-                if (check_legal(move))
-                    white_possible_moves.push_back(move);
-            }
-        }
+// Moves a piece to an empty square.
+void GameState::movePiece(int fromX, int fromY, int toX, int toY) {
+    int piece = board[fromX][fromY];
+    Bitboard fromTo = squareBB(square(fromX, fromY)) | squareBB(square(toX, toY));
+    int color = (piece > 0) ? WhiteIndex : BlackIndex;
+    board[fromX][fromY] = 0;
+    board[toX][toY] = piece;
+    pieceBitboards[color][abs(piece)] ^= fromTo;
+    pieceBitboards[color][0] ^= fromTo;
+    occupied ^= fromTo;
+}
 
+// Swaps the piece on a square for another one while updating the zobrist key
+// (used when the gui tells us the pawn promoted to something other than a queen).
+void GameState::replacePiece(int x, int y, int piece) {
+    int oldPiece = board[x][y];
+    if (oldPiece != 0) {
+        zobristKey ^= table->pieceKeys[colorIndex(oldPiece > 0 ? 1 : -1)][abs(oldPiece)][x][y];
+        removePiece(x, y);
     }
-    else {
+    if (piece != 0) {
+        zobristKey ^= table->pieceKeys[colorIndex(piece > 0 ? 1 : -1)][abs(piece)][x][y];
+        putPiece(x, y, piece);
+    }
+}
 
-        if (x + 1 == 7) flag = Move::Promotion;
+// The following functions all Generate legal moves for the pieces and push it to the object's move vector.
+// Instead of trying every move and checking if it leaves the king in check, the checkers and the pinned pieces
+// are found once per position by find_checks_and_pins and every piece only gets the targets that are legal
+// for it. Only the king moves and en passant still need their own attack checks.
+// The generators are templates on the side to move so the directions, rows and castling squares are constants
+// and the white and black versions are compiled separately instead of branching on the team in every call.
 
-        if (in_board(x + 1, y) && board[x + 1][y] == 0) {
-            Move move(x, y, x + 1, y, flag);
-            if (check_legal(move))
-                black_possible_moves.push_back(move);
-        }
-        if (in_board(x + 2, y) && board[x + 2][y] == 0 && board[x + 1][y] == 0 && x == 1) {
-            Move move(x, y, x + 2, y, Move::PawnTwoMoves);
-            if (check_legal(move))
-                black_possible_moves.push_back(move);
-        }
+void GameState::add_move(Move& move) {
+    generatedMoves->push_back(move);
+}
 
-        if (in_board(x + 1, y - 1) && board[x + 1][y - 1] > 0) {
-            Move move(x, y, x + 1, y - 1, flag, true);
-            if (check_legal(move))
-                black_possible_moves.push_back(move);
-        }
-        if (in_board(x + 1, y + 1) && board[x + 1][y + 1] > 0) {
-            Move move(x, y, x + 1, y + 1, flag, true);
-            if (check_legal(move))
-                black_possible_moves.push_back(move);
-        }
+// The targets a non king piece on this square can move to without leaving the king in check,
+// a pinned piece can only move along the line between the king and the pinning piece.
+// The generation mask also drops the targets that don't match the kind of moves being generated.
+Bitboard GameState::legal_targets(int sq) {
+    if (pinned & squareBB(sq)) return checkMask & generationMask & lineBB[kingSquare][sq];
+    return checkMask & generationMask;
+}
 
-        if ((enPassantSq.first != 0 || enPassantSq.second != 0) && enPassantSq.first == 5) {
-            if (enPassantSq.first == x + 1 && enPassantSq.second == y - 1) {
-                Move move(x, y, x + 1, y - 1, Move::EnPassant, true);
-                if (check_legal(move))
-                    black_possible_moves.push_back(move);
+// Generate legal moves for the pawns.
+template<Color Us>
+void GameState::pawn_moves(Bitboard pawns) {
+    constexpr Color Them = (Us == White) ? Black : White;
+    constexpr int forward = (Us == White) ? -1 : 1;
+    constexpr int startRow = (Us == White) ? 6 : 1, promotionRow = (Us == White) ? 0 : 7;
+    // The square behind the pawn that moved twice is on row 2 for white and 5 for black.
+    constexpr int enPassantRow = startRow + 4 * forward;
+
+    myPair<int, int> enPassantSq = enPassant();
+    bool canEnPassant = generationType != GenQuiets && (enPassantSq.first != 0 || enPassantSq.second != 0) && enPassantSq.first == enPassantRow;
+
+    while (pawns) {
+        int sq = popLsb(pawns);
+        int x = sq >> 3, y = sq & 7;
+        uint16_t flag = (x + forward == promotionRow) ? Move::Promotion : Move::None;
+        Bitboard legal = legal_targets(sq);
+
+        if (!(occupied & squareBB(square(x + forward, y)))) { // Moving once.
+            if (legal & squareBB(square(x + forward, y))) {
+                Move move(x, y, x + forward, y, flag);
+                add_move(move);
             }
-            if (enPassantSq.first == x + 1 && enPassantSq.second == y + 1) {
-                Move move(x, y, x + 1, y + 1, Move::EnPassant, true);
-                if (check_legal(move))
-                    black_possible_moves.push_back(move);
+
+            // Moving twice, this can still block a check even if moving once doesn't.
+            if (x == startRow && !(occupied & squareBB(square(x + 2 * forward, y))) && (legal & squareBB(square(x + 2 * forward, y)))) {
+                Move move(x, y, x + 2 * forward, y, Move::PawnTwoMoves);
+                add_move(move);
             }
         }
-    }
-}
-
-void GameState::rook_moves(int x, int y, int team) {
-    int x_offsets[] = { 0, 0, 1, -1 }; // defining an array of offsets to loop over and generate moves  
-    int y_offsets[] = { 1, -1, 0, 0 }; // in the four vertical and horizontal directions.
 
-    for (int i = 0; i < 4; i++) {
-        int target_x = x + x_offsets[i], target_y = y + y_offsets[i];
-        while (in_board(target_x, target_y)) {
-            int piece = board[target_x][target_y];
-            if (piece * team > 0) break; // breaking before pushing the position of a friendly piece.
+        // Diagonal piece capturing.
+        Bitboard attacks = pawnAttacks[Us][sq];
+        Bitboard captures = attacks & pieceBitboards[Them][0] & legal;
+        while (captures) {
+            int target = popLsb(captures);
+            Move move(x, y, target >> 3, target & 7, flag, true);
+            add_move(move);
+        }
 
-            Move move(x, y, target_x, target_y, Move::None, (piece != 0));
-            if (team == 1 && check_legal(move)) 
-                white_possible_moves.push_back(move);
-            else if (team != 1 && check_legal(move))
-                black_possible_moves.push_back(move);
+        // En passant removes two pieces from the same row which can uncover an attack on the king that the pin
+        // detection doesn't see, so it's checked by looking at the board after the capture.
+        if (canEnPassant) {
+            int target = square(enPassantSq.first, enPassantSq.second);
+            if (attacks & squareBB(target)) {
+                int capturedSq = square(x, enPassantSq.second);
+                Bitboard occupiedAfter = (occupied ^ squareBB(sq) ^ squareBB(capturedSq)) | squareBB(target);
+                Bitboard enemyAttackers = attackers(kingSquare, Them, occupiedAfter) & ~squareBB(capturedSq);
 
-            if (piece * team < 0) break; // breaking after pushing the position of exactly one enemy piece.
-            target_x += x_offsets[i]; target_y += y_offsets[i];
+                if (!enemyAttackers) {
+                    Move move(x, y, enPassantSq.first, enPassantSq.second, Move::EnPassant, true);
+                    add_move(move);
+                }
+            }
         }
     }
 }
 
+// Generate legal moves for the knights, bishops, rooks or queens, the piece type picks the attack lookup at compile time.
+template<Color Us, int Type>
+void GameState::piece_moves(Bitboard pieces) {
+    constexpr Color Them = (Us == White) ? Black : White;
 
-void GameState::king_moves(int x, int y, int team) {
-    int x_offsets[] = { 1, 1, 1, -1, -1, -1, 0, 0 };
-    int y_offsets[] = { -1, 0, 1, -1, 0, 1, 1, -1 };
+    while (pieces) {
+        int sq = popLsb(pieces);
+        int x = sq >> 3, y = sq & 7;
+        Bitboard targets = pieceAttacks<Type>(sq, occupied) & ~pieceBitboards[Us][0] & legal_targets(sq);
+        while (targets) {
+            int target = popLsb(targets);
+            Move move(x, y, target >> 3, target & 7, Move::None, (pieceBitboards[Them][0] & squareBB(target)) != 0);
+            add_move(move);
+        }
+    }
+}
 
+template<Color Us>
+void GameState::king_moves(int sq) {
+    constexpr Color Them = (Us == White) ? Black : White;
+    constexpr int row = (Us == White) ? 7 : 0;
+    constexpr uint16_t queenSide = (Us == White) ? WQueenSide : BQueenSide;
+    constexpr uint16_t kingSide = (Us == White) ? WKingSide : BKingSide;
+    int x = sq >> 3, y = sq & 7;
+
+    // The king is taken off the board while looking for attacks so it can't hide behind itself
+    // from a slider that is checking it.
+    Bitboard withoutKing = occupied ^ squareBB(sq);
+    Bitboard targets = kingAttacks[sq] & ~pieceBitboards[Us][0] & generationMask;
+    while (targets) {
+        int target = popLsb(targets);
+        if (attackers(target, Them, withoutKing)) continue;
+        Move move(x, y, target >> 3, target & 7, Move::None, (pieceBitboards[Them][0] & squareBB(target)) != 0);
+        add_move(move);
+    }
 
     // Castling:
     //      a b c d e f g h
@@ -290,164 +399,139 @@ void GameState::king_moves(int x, int y, int team) {
     //  2   P P P P P P P P
     //  1   R N B Q K B N R
     // BQ -> a8, BK -> h8, WQ -> a1, WK -> h1
+    // The king can't castle out of, through or into a check.
 
-    for (int i = 0; i < 8; i++) {
-        int target_x = x + x_offsets[i], target_y = y + y_offsets[i];
-        int piece = board[target_x][target_y];
-        if (in_board(target_x, target_y) && piece * team <= 0) {
-            Move move(x, y, target_x, target_y, Move::None, (piece != 0));
-            if (team == 1 && check_legal(move))
-                white_possible_moves.push_back(move);
-            else if (team != 1 && check_legal(move))
-                black_possible_moves.push_back(move);
-        }
-    }
-
+    if (checkers || generationType == GenCaptures) return;
 
-    if (team == 1) {
-        if (!board[7][1] && !board[7][2] && !board[7][3] && canCastle(WQueenSide))
-            if (!checked(7, 3, 1) && !checked(x, y, 1)) {
-                Move move(x, y, 7, 2, Move::Castling);
-                if (check_legal(move))
-                    white_possible_moves.push_back(move);
-            }
-        if (!board[7][5] && !board[7][6] && canCastle(WKingSide))
-            if (!checked(7, 5, 1) && !checked(x, y, 1)) {
-                Move move(x, y, 7, 6, Move::Castling);
-                if (check_legal(move))
-                    white_possible_moves.push_back(move);
-            }
-    }
-    else {
-        if (!board[0][1] && !board[0][2] && !board[0][3] && canCastle(BQueenSide)) {
-            if (!checked(0, 3, -1) && !checked(x, y, -1)) {
-                Move move(x, y, 0, 2, Move::Castling);
-                if (check_legal(move))
-                    black_possible_moves.push_back(move);
-            }
+    if (!board[row][1] && !board[row][2] && !board[row][3] && canCastle(queenSide))
+        if (!attackers(square(row, 3), Them, occupied) && !attackers(square(row, 2), Them, occupied)) {
+            Move move(x, y, row, 2, Move::Castling);
+            add_move(move);
         }
-        if (!board[0][5] && !board[0][6] && canCastle(BKingSide)) {
-            if (!checked(0, 5, -1) && !checked(x, y, -1)) {
-                Move move(x, y, 0, 6, Move::Castling);
-                if (check_legal(move))
-                    black_possible_moves.push_back(move);
-            }
+    if (!board[row][5] && !board[row][6] && canCastle(kingSide))
+        if (!attackers(square(row, 5), Them, occupied) && !attackers(square(row, 6), Them, occupied)) {
+            Move move(x, y, row, 6, Move::Castling);
+            add_move(move);
         }
+}
+
+// Matches the type of a piece to its generator, only used for single pieces since
+// the full generation loops over the bitboard of every piece type directly.
+template<Color Us>
+void GameState::generate_piece_moves(int sq, int type) {
+    switch (type) {
+    case 1: king_moves<Us>(sq); break;
+    case 2: piece_moves<Us, 2>(squareBB(sq)); break;
+    case 3: piece_moves<Us, 3>(squareBB(sq)); break;
+    case 4: piece_moves<Us, 4>(squareBB(sq)); break;
+    case 5: piece_moves<Us, 5>(squareBB(sq)); break;
+    case 6: pawn_moves<Us>(squareBB(sq)); break;
     }
 }
 
+// Finds the pieces checking the king and the pieces pinned to it which decide the legal targets of every other piece.
+template<Color Us>
+void GameState::find_checks_and_pins() {
+    constexpr Color Them = (Us == White) ? Black : White;
+    const Bitboard* enemy = pieceBitboards[Them];
 
-void GameState::knight_moves(int x, int y, int team) {
-    int x_offsets[] = { -2, -1, -2, -1, 1, 1, 2, 2 };
-    int y_offsets[] = { 1, 2, -1, -2, -2, 2, -1, 1 };
+    kingSquare = lsb(pieceBitboards[Us][1]);
+    checkers = attackers(kingSquare, Them, occupied);
 
-    for (int i = 0; i < 8; i++) {
-        int target_x = x + x_offsets[i], target_y = y + y_offsets[i];
-        int piece = board[target_x][target_y];
-        if (in_board(target_x, target_y) && piece * team <= 0) {
-            Move move(x, y, target_x, target_y, Move::None, (piece != 0));
-            if (team == 1 && check_legal(move))
-                white_possible_moves.push_back(move);
-            else if (team != 1 && check_legal(move))
-                black_possible_moves.push_back(move);
-        }
-    }
+    // With one checker the other pieces have to capture it or block it, with two only the king can move.
+    if (!checkers) checkMask = ~0ULL;
+    else if (!(checkers & (checkers - 1))) checkMask = checkers | betweenBB[kingSquare][lsb(checkers)];
+    else checkMask = 0;
 
+    // Enemy sliders that would see the king on an empty board pin a piece of ours
+    // if it's the only piece standing between them.
+    pinned = 0;
+    Bitboard snipers = (rookAttacks(kingSquare, 0) & (enemy[3] | enemy[2])) | (bishopAttacks(kingSquare, 0) & (enemy[5] | enemy[2]));
+    while (snipers) {
+        Bitboard between = betweenBB[kingSquare][popLsb(snipers)] & occupied;
+        if (between && !(between & (between - 1)) && (between & pieceBitboards[Us][0])) pinned |= between;
+    }
 }
 
+// Sets which kind of moves the generators produce, captures (including en passant), quiet moves
+// (including castling and non capturing promotions) or all of them.
+void GameState::set_generation_type(int type) {
+    generationType = type;
+    int them = colorIndex(player) ^ 1;
+    if (type == GenCaptures) generationMask = pieceBitboards[them][0];
+    else if (type == GenQuiets) generationMask = ~occupied;
+    else generationMask = ~0ULL;
+}
 
-void GameState::bishop_moves(int x, int y, int team) {
-    int x_offsets[] = { 1, 1, -1, -1 }; // defining an array of offsets like the rook function but
-    int y_offsets[] = { 1, -1, 1, -1 }; // in the four diagonal directions.
-
-    for (int i = 0; i < 4; i++) {
-        int target_x = x + x_offsets[i], target_y = y + y_offsets[i];
-        while (in_board(target_x, target_y)) {
-            int piece = board[target_x][target_y];
-            if (piece * team > 0) break;
+// Generates all the possible moves for the player and stores them
+// in the object's white_possible_moves or black_possible_moves.
+void GameState::generate_all_possible_moves(int team, int type) {
+    // White -> 1 , Black -> -1
+    // If the parameter type == 1 then it will only generate moves for white
+    // if it was -1 then it will only generate moves for black.
 
-            Move move(x, y, target_x, target_y, Move::None, (piece != 0));
-            if (team == 1 && check_legal(move))
-                white_possible_moves.push_back(move);
-            else if (team != 1 && check_legal(move))
-                black_possible_moves.push_back(move);
+    if (team != player) runtime_error("Can generate possible moves only for the current player");
 
-            if (piece * team < 0) break;
-            target_x += x_offsets[i]; target_y += y_offsets[i];
-        }
-    }
+    generate_moves((team == 1) ? white_possible_moves : black_possible_moves, type);
 }
 
+// Loops over the pieces of one side, one piece type at a time.
+template<Color Us>
+void GameState::generate_color_moves() {
+    find_checks_and_pins<Us>();
 
-void GameState::queen_moves(int x, int y, int team) {
-    int x_offsets[] = { 1, 1, -1, -1, 0, 0, 1, -1 };
-    int y_offsets[] = { 1, -1, 1, -1, 1, -1, 0, 0 };
+    king_moves<Us>(kingSquare);
 
-    for (int i = 0; i < 8; i++) {
-        int target_x = x + x_offsets[i], target_y = y + y_offsets[i];
-        while (in_board(target_x, target_y)) {
-            int piece = board[target_x][target_y];
-            if (piece * team > 0) break;
-
-            Move move(x, y, target_x, target_y, Move::None, (piece != 0));
-            if (team == 1 && check_legal(move))
-                white_possible_moves.push_back(move);
-            else if (team != 1 && check_legal(move))
-                black_possible_moves.push_back(move);
-
-            if (piece * team < 0) break;
-            target_x += x_offsets[i]; target_y += y_offsets[i];
-        }
-    }
+    // In a double check every target is masked out anyway so only the king is worth looking at.
+    if (checkMask == 0) return;
+
+    const Bitboard* pieces = pieceBitboards[Us];
+    pawn_moves<Us>(pieces[6]);
+    piece_moves<Us, 4>(pieces[4]);
+    piece_moves<Us, 5>(pieces[5]);
+    piece_moves<Us, 3>(pieces[3]);
+    piece_moves<Us, 2>(pieces[2]);
 }
 
+// Generates the moves of the player into the given list.
+void GameState::generate_moves(MoveList& moves, int type) {
+    moves.clear();
+    generatedMoves = &moves;
+    set_generation_type(type);
 
-// Matches the type of a specific piece and calls it's moves generation function.
-void GameState::generate_piece_moves(int x, int y, int team, int type) {
-    if (type == 1)
-        king_moves(x, y, team);
-    else if (type == 2)
-        queen_moves(x, y, team);
-    else if (type == 3)
-        rook_moves(x, y, team);
-    else if (type == 4)
-        knight_moves(x, y, team);
-    else if (type == 5)
-        bishop_moves(x, y, team);
-    else if (type == 6)
-        pawn_moves(x, y, team);
+    if (player == 1) generate_color_moves<White>();
+    else generate_color_moves<Black>();
 }
 
-// Loops over the board to generate all the possible moves for each piece storing it 
-// in the object's white_possible_moves or black_possible_moves.
-void GameState::generate_all_possible_moves(int team) {
-    // White -> 1 , Black -> -1
-    // If the parameter type == 1 then it will only generate moves for white
-    // if it was -1 then it will only generate moves for black.
+// Checks if a move that didn't come from the move generator (like a transposition table move or a killer move)
+// is legal in the current position by only generating the moves of the piece standing on its starting square.
+bool GameState::is_legal_move(Move move) {
+    int piece = board[move.FromX()][move.FromY()];
+    if (piece == 0 || (piece > 0) != (player == 1)) return false;
 
-    if (team != player) runtime_error("Can generate possible moves only for the current player");
+    MoveList possible;
+    generatedMoves = &possible;
+    set_generation_type(GenAll);
 
-    if (team == 1) white_possible_moves.clear();
-    else black_possible_moves.clear();
+    int sq = square(move.FromX(), move.FromY());
+    if (player == 1) {
+        find_checks_and_pins<White>();
+        generate_piece_moves<White>(sq, piece);
+    }
+    else {
+        find_checks_and_pins<Black>();
+        generate_piece_moves<Black>(sq, -piece);
+    }
 
-    for (int i = 0; i < 8; i++) {
-        for (int j = 0; j < 8; j++) {
-            int type = board[i][j];
-            if (board[i][j] > 0 && player == 1) {
-                generate_piece_moves(i, j, 1, type);
-            }
-            else if (board[i][j] < 0 && player != 1) {
-                generate_piece_moves(i, j, -1, abs(type));
-            }
-        }
+    for (int i = 0; i < possible.size(); i++) {
+        if (possible[i].move == move.move) return true;
     }
+    return false;
 }
 
 // A function used for testing and debugging.
 void GameState::display_possible_moves() {
-    myVector<Move> possible;
-    if (player == 1) possible = white_possible_moves;
-    else  possible = black_possible_moves;
+    MoveList& possible = (player == 1) ? white_possible_moves : black_possible_moves;
     cout << "Possible moves: " << endl;
     for (int i = 0; i < possible.size(); i++) {
         Move move = possible[i];
@@ -456,78 +540,125 @@ void GameState::display_possible_moves() {
 }
 
 
-// Checks if this position is threatened by an enemy piece.
-bool GameState::checked(int kingx, int kingy, int type) {
-    // Checking if a knight threatens the king.
-    int knight_x_offsets[] = { -2, -1, -2, -1, 1, 1, 2, 2 };
-    int knight_y_offsets[] = { 1, 2, -1, -2, -2, 2, -1, 1 };
+// Every piece of the given color attacking the square when the board has the given occupancy.
+// Every attacker type is looked up from the square itself, if a knight on this square would
+// attack an enemy knight then that knight attacks this square and the same goes for the other pieces.
+Bitboard GameState::attackers(int sq, int color, Bitboard occupancy) {
+    const Bitboard* pieces = pieceBitboards[color];
+    return (knightAttacks[sq] & pieces[4])
+        | (pawnAttacks[color ^ 1][sq] & pieces[6])
+        | (kingAttacks[sq] & pieces[1])
+        | (rookAttacks(sq, occupancy) & (pieces[3] | pieces[2]))
+        | (bishopAttacks(sq, occupancy) & (pieces[5] | pieces[2]));
+}
 
-    for (int i = 0; i < 8; i++) {
-        int tx = kingx + knight_x_offsets[i];
-        int ty = kingy + knight_y_offsets[i];
-        if (in_board(tx, ty) && board[tx][ty] * type == -4) {
-            return 1;
-        }
+// Static exchange evaluation, the material the side to move wins or loses (a negative value) if both sides
+// keep capturing on the target square of the move with their least valuable piece and may stop whenever
+// going on would lose more. Sliders hiding behind the pieces that captured (x-rays) join in as they
+// are uncovered, pins are ignored.
+int GameState::see(Move move) {
+    int from = square(move.FromX(), move.FromY()), to = square(move.ToX(), move.ToY());
+    int gain[32], d = 0;
+
+    int nextVictim = abs(board[move.FromX()][move.FromY()]);
+    gain[0] = move.IsEnPassant() ? seeValue[6] : seeValue[abs(board[move.ToX()][move.ToY()])];
+    if (move.IsPromotion()) {
+        gain[0] += seeValue[2] - seeValue[6];
+        nextVictim = 2;
     }
 
-    int x_offsets[] = { 0, 0, 1, -1, 1, 1, -1, -1 };
-    int y_offsets[] = { 1, -1, 0, 0, 1, -1, 1, -1 };
+    Bitboard occupancy = occupied ^ squareBB(from);
+    if (move.IsEnPassant()) occupancy ^= squareBB(square(move.FromX(), move.ToY()));
 
-    // Checking if a sliding piece (Rook, Queen, Bishop) is attacking the king vertically or horizontally.
-    for (int i = 0; i < 4; i++) {
-        int tx = kingx + x_offsets[i], ty = kingy + y_offsets[i];
-        while (in_board(tx, ty)) {
-            int piece = board[tx][ty];
-            if (piece * type == -3 || piece * type == -2) {
-                return 1;
-            }
-            if (piece != 0) break;
-            tx += x_offsets[i]; ty += y_offsets[i];
-        }
-    }
+    Bitboard diagonalSliders = pieceBitboards[0][5] | pieceBitboards[0][2] | pieceBitboards[1][5] | pieceBitboards[1][2];
+    Bitboard straightSliders = pieceBitboards[0][3] | pieceBitboards[0][2] | pieceBitboards[1][3] | pieceBitboards[1][2];
+    Bitboard allAttackers = (attackers(to, WhiteIndex, occupancy) | attackers(to, BlackIndex, occupancy)) & occupancy;
 
-    // Checking if a sliding piece (Rook, Queen, Bishop) is attacking the king diagonally.
-    for (int i = 4; i < 8; i++) {
-        int tx = kingx + x_offsets[i], ty = kingy + y_offsets[i];
-        while (in_board(tx, ty)) {
-            int piece = board[tx][ty];
-            if (piece * type == -5 || piece * type == -2) {
-                return 1;
-            }
-            if (piece != 0) break;
-            tx += x_offsets[i]; ty += y_offsets[i];
+    // The attackers from the cheapest to the most valuable.
+    static constexpr int captureOrder[6] = { 6, 4, 5, 3, 2, 1 };
+    int side = colorIndex(player) ^ 1;
+
+    while (d < 31) {
+        Bitboard ours = allAttackers & pieceBitboards[side][0];
+        if (!ours) break;
+
+        int attackerType = 0;
+        Bitboard attacker = 0;
+        for (int type : captureOrder) {
+            attacker = ours & pieceBitboards[side][type];
+            if (attacker) { attackerType = type; break; }
         }
-    }
+        // The king can only take the last piece, otherwise it would be captured back.
+        if (attackerType == 1 && (allAttackers & pieceBitboards[side ^ 1][0])) break;
 
-    // Checking for the other king.
-    for (int i = 0; i < 8; i++) {
-        int tx = kingx + x_offsets[i], ty = kingy + y_offsets[i];
-        if (in_board(tx, ty) && board[tx][ty] * type == -1) return 1;
-    }
+        // The score of this side if it captures and nothing else happens, when even that is negative
+        // and the other side is ahead anyway this side just stops and it doesn't change the result.
+        int score = seeValue[nextVictim] - gain[d];
+        if (max(-gain[d], score) < 0) break;
+        gain[++d] = score;
+
+        occupancy ^= attacker & (0 - attacker);
+        if (attackerType == 6 || attackerType == 5 || attackerType == 2)
+            allAttackers |= bishopAttacks(to, occupancy) & diagonalSliders;
+        if (attackerType == 3 || attackerType == 2)
+            allAttackers |= rookAttacks(to, occupancy) & straightSliders;
+        allAttackers &= occupancy;
 
-    // Checking for pawns.
-    if (type > 0) {
-        if (in_board(kingx - 1, kingy - 1) && board[kingx - 1][kingy - 1] == -6) { return 1; }
-        if (in_board(kingx - 1, kingy + 1) && board[kingx - 1][kingy + 1] == -6) { return 1; }
+        nextVictim = attackerType;
+        side ^= 1;
     }
-    else {
-        if (in_board(kingx + 1, kingy - 1) && board[kingx + 1][kingy - 1] == 6) { return 1; }
-        if (in_board(kingx + 1, kingy + 1) && board[kingx + 1][kingy + 1] == 6) { return 1; }
+
+    // Going back over the exchange every side picks between capturing and stopping.
+    while (d > 0) {
+        gain[d - 1] = -max(-gain[d - 1], gain[d]);
+        d--;
     }
+    return gain[0];
+}
 
-    return 0;
+// Checks if this position is threatened by an enemy piece.
+bool GameState::checked(int kingx, int kingy, int type) {
+    return attackers(square(kingx, kingy), colorIndex(type) ^ 1, occupied) != 0;
 }
 
 // Update the internal representation of the board inside the GameState object 
 // while handling special moves like en passants, castling and promotions.
 void GameState::makeMove(Move& move) {
+    if (player == 1) make_move<White>(move);
+    else make_move<Black>(move);
+}
+
+void GameState::unMakeMove(Move& move) {
+    // The player was already switched by makeMove so the side that made the move is the other one.
+    if (player == 1) unmake_move<Black>(move);
+    else unmake_move<White>(move);
+}
+
+template<Color Us>
+void GameState::make_move(Move& move) {
+    constexpr Color Them = (Us == White) ? Black : White;
+    constexpr int sign = (Us == White) ? 1 : -1;
+    constexpr int backRow = (Us == White) ? 7 : 0, enemyBackRow = 7 - backRow;
+    constexpr int forward = (Us == White) ? -1 : 1;
+    constexpr uint16_t queenSide = (Us == White) ? WQueenSide : BQueenSide;
+    constexpr uint16_t kingSide = (Us == White) ? WKingSide : BKingSide;
+    constexpr uint16_t enemyQueenSide = (Us == White) ? BQueenSide : WQueenSide;
+    constexpr uint16_t enemyKingSide = (Us == White) ? BKingSide : WKingSide;
+
     gameStateHistory.push_back(currentGameState);
     zobristKeys.push_back(zobristKey);
 
     int fromX = move.FromX(), fromY = move.FromY();
     int toX = move.ToX(), toY = move.ToY();
-    int pieceToMove = board[fromX][fromY], targetPiece = board[toX][toY];
+    int type = board[fromX][fromY] * sign, targetPiece = board[toX][toY];
 
+    // Captures and pawn moves can't be undone so they restart the count of the fifty move rule.
+    halfmoveClocks.push_back(halfmoveClock);
+    halfmoveClock = (type == 6 || move.IsCapture()) ? 0 : halfmoveClock + 1;
+    if (Us == Black) fullmoveNumber++;
+
+    // The castling rights and the en passant square are hashed again once they are updated.
+    zobristKey ^= table->gameStateKey(currentGameState);
     currentGameState &= ~(63U << 4); // Clearing the enPassant bits.
 
     // Reassigning captured piece.
@@ -535,149 +666,92 @@ void GameState::makeMove(Move& move) {
     currentGameState |= (abs(targetPiece) << 10);
     if (targetPiece > 0) currentGameState |= (1 << 13);
 
-    board[fromX][fromY] = 0;
-    board[toX][toY] = pieceToMove;
+    if (targetPiece != 0) {
+        removePiece(toX, toY);
+        zobristKey ^= table->pieceKeys[Them][-targetPiece * sign][toX][toY];
 
-    // Updating the zobrist key.
-    if (pieceToMove > 0) {
-        zobristKey ^= table->pieceKeys[0][pieceToMove][fromX][fromY];
-        zobristKey ^= table->pieceKeys[0][pieceToMove][toX][toY];
-    }
-    else {
-        zobristKey ^= table->pieceKeys[1][abs(pieceToMove)][fromX][fromY];
-        zobristKey ^= table->pieceKeys[1][abs(pieceToMove)][toX][toY];
+        // Capturing a rook on its starting square also takes away the castling rights on that side.
+        if (targetPiece == -3 * sign && toX == enemyBackRow) {
+            if (toY == 0) currentGameState &= ~enemyQueenSide;
+            else if (toY == 7) currentGameState &= ~enemyKingSide;
+        }
     }
+    movePiece(fromX, fromY, toX, toY);
 
-    if (targetPiece > 0) {
-        zobristKey ^= table->pieceKeys[0][targetPiece][toX][toY];
-    }
-    else if (targetPiece < 0) {
-        zobristKey ^= table->pieceKeys[1][abs(targetPiece)][toX][toY];
-    }
+    // Updating the zobrist key.
+    zobristKey ^= table->pieceKeys[Us][type][fromX][fromY];
+    zobristKey ^= table->pieceKeys[Us][type][toX][toY];
 
-    
-    // Changing the position of the white and black king used for O(1) access to king positions
+    // Changing the position of the king used for O(1) access to king positions
     // and changing castling rights if king or rook moved.
-    if (pieceToMove == 1) {
-        currentGameState &= ~(WQueenSide | WKingSide);
-        white_king = { toX, toY };
-    }
-    else if (pieceToMove == -1) {
-        currentGameState &= ~(BQueenSide | BKingSide);
-        black_king = { toX, toY };
-    }
-    else if (pieceToMove == -3){
-        if (fromY == 0 && fromX == 0) currentGameState &= ~(BQueenSide);
-        else if (fromY == 7 && fromX == 0) currentGameState &= ~(BKingSide);
+    if (type == 1) {
+        currentGameState &= ~(queenSide | kingSide);
+        if (Us == White) white_king = { toX, toY };
+        else black_king = { toX, toY };
     }
-    else if (pieceToMove == 3) {
-        if (fromY == 0 && fromX == 7) currentGameState &= ~(WQueenSide);
-        else if (fromY == 7 && fromX == 7) currentGameState &= ~(WKingSide);
+    else if (type == 3 && fromX == backRow) {
+        if (fromY == 0) currentGameState &= ~queenSide;
+        else if (fromY == 7) currentGameState &= ~kingSide;
     }
 
     if (move.IsPromotion()) {
-        board[toX][toY] = 2 * player;
-        if (player == 1) {
-            zobristKey ^= table->pieceKeys[0][6][toX][toY];
-            zobristKey ^= table->pieceKeys[0][2][toX][toY];
-        }
-        else {
-            zobristKey ^= table->pieceKeys[1][6][toX][toY];
-            zobristKey ^= table->pieceKeys[1][2][toX][toY];
-        }
+        removePiece(toX, toY);
+        putPiece(toX, toY, 2 * sign);
+        zobristKey ^= table->pieceKeys[Us][6][toX][toY];
+        zobristKey ^= table->pieceKeys[Us][2][toX][toY];
     }
     else if (move.IsCastle()) {
-        // Flag the kings and rooks as moved to make them lose castling rights
-        if (toX == 0 && toY == 2) {
-            swap(board[0][0], board[0][3]);     
-            zobristKey ^= table->pieceKeys[1][3][0][0];
-            zobristKey ^= table->pieceKeys[1][3][0][3];
-        }
-        else if (toX == 0 && toY == 6) {
-            swap(board[0][7], board[0][5]);
-            zobristKey ^= table->pieceKeys[1][3][0][7];
-            zobristKey ^= table->pieceKeys[1][3][0][5];
-        }
-        else if (toX == 7 && toY == 2) {
-            swap(board[7][0], board[7][3]);
-            zobristKey ^= table->pieceKeys[0][3][7][0];
-            zobristKey ^= table->pieceKeys[0][3][7][3];
-        }
-        else if (toX == 7 && toY == 6) {
-            swap(board[7][7], board[7][5]);
-            zobristKey ^= table->pieceKeys[0][3][7][7];
-            zobristKey ^= table->pieceKeys[0][3][7][5];
-        }
+        // Moving the rook to the other side of the king.
+        int rookFrom = (toY == 2) ? 0 : 7, rookTo = (toY == 2) ? 3 : 5;
+        movePiece(backRow, rookFrom, backRow, rookTo);
+        zobristKey ^= table->pieceKeys[Us][3][backRow][rookFrom];
+        zobristKey ^= table->pieceKeys[Us][3][backRow][rookTo];
     }
     else if (move.IsPawnTwoMoves()) {
-        // Check if the move is a pawn who moved twice to flag
-        // an en passant as an available move.
-        if (player == 1) {
-            currentGameState |= ((toX + 1U) << 4); // Flagging the sqaure behind the pawn as open for en passant.
-            currentGameState |= (toY << 7); 
-        }
-        else {
-            currentGameState |= ((toX - 1U) << 4);
-            currentGameState |= (toY << 7);
-        }
-
+        // Flagging the sqaure behind the pawn as open for en passant.
+        currentGameState |= ((unsigned)(toX - forward) << 4);
+        currentGameState |= (toY << 7);
     }
     else if (move.IsEnPassant()) {
-        if (player == 1) {
-            board[toX + 1][toY] = 0;
-            zobristKey ^= table->pieceKeys[1][6][toX + 1][toY];
-        }
-        else {
-            board[toX - 1][toY] = 0;
-            zobristKey ^= table->pieceKeys[0][6][toX - 1][toY];
-        }
+        removePiece(toX - forward, toY);
+        zobristKey ^= table->pieceKeys[Them][6][toX - forward][toY];
     }
 
-    player *= -1;
-    zobristKey ^= table->blackToMove;
+    player = -sign;
+    zobristKey ^= table->blackToMove ^ table->gameStateKey(currentGameState);
+    table->prefetch(zobristKey);
 }
 
-void GameState::unMakeMove(Move& move) {
+template<Color Us>
+void GameState::unmake_move(Move& move) {
+    constexpr int sign = (Us == White) ? 1 : -1;
+    constexpr int backRow = (Us == White) ? 7 : 0;
+    constexpr int forward = (Us == White) ? -1 : 1;
+
     int fromX = move.FromX(), fromY = move.FromY();
     int toX = move.ToX(), toY = move.ToY();
     int pieceToReturn = board[toX][toY], captured = capturedPiece();
 
-    board[fromX][fromY] = pieceToReturn;
-    board[toX][toY] = captured;
+    movePiece(toX, toY, fromX, fromY);
+    if (captured != 0) putPiece(toX, toY, captured);
 
-    player *= -1;
+    player = sign;
 
-    if (pieceToReturn == 1) {
-        white_king = { fromX, fromY };
-    }
-    else if (pieceToReturn == -1) {
-        black_king = { fromX, fromY };
+    if (pieceToReturn == sign) {
+        if (Us == White) white_king = { fromX, fromY };
+        else black_king = { fromX, fromY };
     }
 
     if (move.IsPromotion()) {
-        board[fromX][fromY] = 6 * player;
+        removePiece(fromX, fromY);
+        putPiece(fromX, fromY, 6 * sign);
     }
     else if (move.IsCastle()) {
-        if (toX == 0 && toY == 2) {
-            swap(board[0][0], board[0][3]);
-        }
-        else if (toX == 0 && toY == 6) {
-            swap(board[0][7], board[0][5]);
-        }
-        else if (toX == 7 && toY == 2) {
-            swap(board[7][0], board[7][3]);
-        }
-        else if (toX == 7 && toY == 6) {
-            swap(board[7][7], board[7][5]);
-        }
+        if (toY == 2) movePiece(backRow, 3, backRow, 0);
+        else movePiece(backRow, 5, backRow, 7);
     }
     else if (move.IsEnPassant()) {
-        if (player == 1) {
-            board[toX + 1][toY] = -6;
-        }
-        else {
-            board[toX - 1][toY] = 6;
-        }
+        putPiece(toX - forward, toY, -6 * sign);
     }
 
     currentGameState = gameStateHistory[gameStateHistory.size() - 1];
@@ -685,30 +759,61 @@ void GameState::unMakeMove(Move& move) {
 
     zobristKey = zobristKeys[zobristKeys.size() - 1];
     zobristKeys.pop_back();
+
+    halfmoveClock = halfmoveClocks[halfmoveClocks.size() - 1];
+    halfmoveClocks.pop_back();
+    if (Us == Black) fullmoveNumber--;
 }
 
 
-// checks if the move is legal by simulating a move and checking for checkMates.
-bool GameState::check_legal(Move& move) { 
-    int kingx, kingy, currentPlayer = player;
+// Passes the turn to the opponent without moving anything, used by null move pruning.
+// There can't be an en passant capture after a pass and nothing was captured. The halfmove clock restarts
+// so repetitions aren't looked for across the pass, the position after it can't occur in a real game.
+void GameState::makeNullMove() {
+    gameStateHistory.push_back(currentGameState);
+    zobristKeys.push_back(zobristKey);
+    halfmoveClocks.push_back(halfmoveClock);
+    halfmoveClock = 0;
 
-    makeMove(move);
+    zobristKey ^= table->gameStateKey(currentGameState);
+    currentGameState &= ~(63U << 4);
+    currentGameState &= ~(15U << 10);
+    zobristKey ^= table->gameStateKey(currentGameState) ^ table->blackToMove;
 
-    if (currentPlayer == 1) {
-        kingx = white_king.first;
-        kingy = white_king.second;
-    }
-    else {
-        kingx = black_king.first;
-        kingy = black_king.second;
-    }
+    player *= -1;
+    table->prefetch(zobristKey);
+}
+
+void GameState::unmakeNullMove() {
+    player *= -1;
+
+    currentGameState = gameStateHistory[gameStateHistory.size() - 1];
+    gameStateHistory.pop_back();
+
+    zobristKey = zobristKeys[zobristKeys.size() - 1];
+    zobristKeys.pop_back();
+
+    halfmoveClock = halfmoveClocks[halfmoveClocks.size() - 1];
+    halfmoveClocks.pop_back();
+}
 
-    bool isLegal = true;
-    if (checked(kingx, kingy, currentPlayer)) isLegal = false;
+// Checks if the current position already happened since the last irreversible move. The keys of the
+// positions with the same side to move are every second one and the closest could only be 4 plies ago.
+bool GameState::isRepetition() {
+    return repetitionDistance() > 0;
+}
 
-    unMakeMove(move);
+// How many plies ago the current position last happened, 0 if it didn't since the last irreversible move.
+int GameState::repetitionDistance() {
+    int last = zobristKeys.size();
+    for (int plies = 4; plies <= halfmoveClock && plies <= last; plies += 2) {
+        if (zobristKeys[last - plies] == zobristKey) return plies;
+    }
+    return 0;
+}
 
-    return isLegal;
+bool GameState::isDrawByFiftyMoves() {
+    return halfmoveClock >= 100;
 }
 
 // Checks if the given player has no moves and the king is checked meaning a checkmate.
@@ -774,7 +879,7 @@ int GameState::capturedPiece() {
 // Given the indices in the board finds the corresponding move which contains
 // additional information. like, if it was a castling move, en Passant etc...
 Move GameState::findMove(int fromX, int fromY, int toX, int toY) {
-    myVector<Move> possible = (board[fromX][fromY] > 0) ? white_possible_moves : black_possible_moves;
+    MoveList& possible = (board[fromX][fromY] > 0) ? white_possible_moves : black_possible_moves;
     for (int i = 0; i < possible.size(); i++) {
         Move move = possible[i];
         if (move.FromX() == fromX && move.FromY() == fromY && move.ToX() == toX && move.ToY() == toY) 
@@ -783,13 +888,174 @@ Move GameState::findMove(int fromX, int fromY, int toX, int toY) {
 }
 
 
-Minimax::Minimax(TranspositionTable& Ttable) : table(&Ttable) {}
+MovePicker::MovePicker(GameState& state, MoveOrderer& orderer, Move ttMove, Move* killers, bool capturesOnly, Move counterMove)
+    : state(state), moveOrderer(orderer), ttMove(ttMove), counterMove(counterMove), capturesOnly(capturesOnly) {
+    this->killers[0] = killers ? killers[0] : Move();
+    this->killers[1] = killers ? killers[1] : Move();
+}
+
+bool MovePicker::isKiller(Move& move) {
+    return move.move == killers[0].move || move.move == killers[1].move;
+}
+
+// Moves that were already handed out by an earlier stage.
+bool MovePicker::alreadyPicked(Move& move) {
+    if (move.move == ttMove.move) return true;
+    if (stage == QuietsStage && (move.move == killers[0].move || move.move == killers[1].move)) return true;
+    return false;
+}
 
+// Selects the move with the highest ordering value from the ones that weren't picked yet,
+// this way the moves are only sorted as far as the search needs them.
+bool MovePicker::pickBest(Move& move) {
+    while (index < moves.size()) {
+        int best = index;
+        for (int i = index + 1; i < moves.size(); i++) {
+            if (moves.scores[i] > moves.scores[best]) best = i;
+        }
 
-bool Minimax::timeLimitExceeded(chrono::steady_clock::time_point& start, chrono::milliseconds& duration, int& depth) {
-    auto current_time = chrono::steady_clock::now();
-    duration = chrono::duration_cast<std::chrono::milliseconds>(current_time - start_time);
-    if (duration.count() > time_limit && depth > least_depth) return true;
+        moves.swap(index, best);
+        move = moves[index++];
+        if (!alreadyPicked(move)) return true;
+    }
+    return false;
+}
+
+// Gives the next move to search and returns false when there are no moves left.
+bool MovePicker::nextMove(Move& move) {
+    while (true) {
+        switch (stage) {
+        case TTMoveStage:
+            stage = GenerateCapturesStage;
+            if (ttMove.move != 0 && (!capturesOnly || ttMove.IsCapture()) && state.is_legal_move(ttMove)) {
+                move = ttMove;
+                return true;
+            }
+            break;
+
+        case GenerateCapturesStage:
+            state.generate_moves(moves, GameState::GenCaptures);
+            moveOrderer.scoreMoves(moves, state.board);
+            index = 0;
+            stage = CapturesStage;
+            break;
+
+        case CapturesStage:
+            while (pickBest(move)) {
+                // A capture of a piece worth at least as much as the capturing one can't lose material.
+                bool cheapAttacker = !move.IsPromotion() && !move.IsEnPassant()
+                    && GameState::seeValue[abs(state.board[move.FromX()][move.FromY()])] <= GameState::seeValue[abs(state.board[move.ToX()][move.ToY()])];
+                if (cheapAttacker || state.see(move) >= 0) return true;
+                if (!capturesOnly) badCaptures[badCaptureCount++] = move;
+            }
+            stage = capturesOnly ? DoneStage : KillersStage;
+            break;
+
+        case KillersStage:
+            while (killerIndex < 2) {
+                Move killer = killers[killerIndex++];
+                if (killer.move != 0 && killer.move != ttMove.move && !killer.IsCapture() && state.is_legal_move(killer)) {
+                    move = killer;
+                    return true;
+                }
+            }
+            stage = GenerateQuietsStage;
+            break;
+
+        case GenerateQuietsStage:
+            state.generate_moves(moves, GameState::GenQuiets);
+            moveOrderer.scoreMoves(moves, state.board, state.player, counterMove);
+            index = 0;
+            stage = QuietsStage;
+            break;
+
+        case QuietsStage:
+            if (pickBest(move)) return true;
+            stage = BadCapturesStage;
+            break;
+
+        case BadCapturesStage:
+            if (badCaptureIndex < badCaptureCount) {
+                move = badCaptures[badCaptureIndex++];
+                return true;
+            }
+            stage = DoneStage;
+            break;
+
+        default:
+            return false;
+        }
+    }
+}
+
+
+// How many plies a late quiet move is reduced by, indexed by the remaining depth and the number of the move.
+// It grows with the log of both since the deeper the search and the later the move the less likely it's the best one.
+static int lateMoveReductions[64][64];
+
+static void initReductions() {
+    for (int depth = 1; depth < 64; depth++) {
+        for (int moveNumber = 1; moveNumber < 64; moveNumber++) {
+            lateMoveReductions[depth][moveNumber] = int(0.75 + log(depth) * log(moveNumber) / 2.25);
+        }
+    }
+}
+
+Minimax::Minimax(TranspositionTable& Ttable) : table(&Ttable) {
+    initReductions();
+}
+
+Minimax::~Minimax() {
+    for (int i = 0; i < helpers.size(); i++) delete helpers[i];
+}
+
+// Creates the helper searches for the threads after the first one.
+void Minimax::setThreads(int threads) {
+    for (int i = 0; i < helpers.size(); i++) delete helpers[i];
+    helpers = myVector<Minimax*>();
+
+    threadCount = max(threads, 1);
+    for (int i = 1; i < threadCount; i++) {
+        Minimax* helper = new Minimax(*table);
+        helper->threadId = i;
+        helper->stop = &stopFlag;
+        helper->moveOrderer.noiseSeed = 2654435761U * i;
+        helpers.push_back(helper);
+    }
+}
+
+// Only the main thread checks the limits, the helpers stop when it raises the shared stop flag.
+// The node limit is checked every time so node limited searches are exactly reproducible with one thread,
+// the clock only every clockCheckNodes nodes unless readClock is set.
+bool Minimax::timeLimitExceeded(int depth, bool readClock) {
+    publishedNodes.store(node_counter, memory_order_relaxed);
+    if (stop->load(memory_order_relaxed)) return true;
+    if (threadId != 0 || depth <= least_depth) return false;
+
+    if (limits.nodes && node_counter >= limits.nodes) {
+        stop->store(true, memory_order_relaxed);
+        return true;
+    }
+
+    if (!readClock && node_counter < nextClockCheck) return false;
+    nextClockCheck = node_counter + clockCheckNodes;
+
+    duration = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start_time);
+    long long elapsed = duration.count();
+    if (sendInfo && elapsed >= nextInfoMs) {
+        nextInfoMs = elapsed + infoIntervalMs;
+        long long nodes = totalNodes();
+        sendInfo("info nodes " + to_string(nodes) + " nps " + to_string(nodes * 1000 / max(elapsed, 1LL))
+            + " hashfull " + to_string(table->hashfull()) + " time " + to_string(elapsed));
+    }
+    if (pondering && ponderHitReceived.load(memory_order_relaxed)) {
+        pondering = false;
+        ponderHitMs = elapsed;
+    }
+    if (limits.timeMs && !limits.infinite && !pondering && elapsed > limits.timeMs + ponderHitMs) {
+        stop->store(true, memory_order_relaxed);
+        return true;
+    }
     return false;
 }
 
@@ -853,48 +1119,36 @@ int Minimax::get_pcsq_value(int x, int y, int piece, bool endgame) {
     }
 }
 
-int Minimax::evaluate_pawns(int team, int white_pawns_row[], int black_pawns_row[]) {
-    int num_isolated = 0;
-    int penalty = 0, bonus = 0;
+template<Color Us>
+int Minimax::evaluate_pawns(int white_pawns_row[], int black_pawns_row[]) {
+    constexpr int sign = (Us == White) ? 1 : -1;
+    int* ourRows = (Us == White) ? white_pawns_row : black_pawns_row;
+    int* theirRows = (Us == White) ? black_pawns_row : white_pawns_row;
+    int num_isolated = 0, bonus = 0;
 
     for (int i = 0; i < 8; i++) {
-        int row_white = white_pawns_row[i], row_black = black_pawns_row[i];
-        if (team == 1 && row_white != -1) {
-            // Isolated pawns.
-            if ((i == 0 || white_pawns_row[i - 1] == -1) && (i == 7 || white_pawns_row[i + 1] == -1)) {
-                num_isolated++;
-            }
+        int row = ourRows[i];
+        if (row == -1) continue;
 
-            // Passed pawns.
-            bool noOpposingPawns = true;
-            if (i > 0 && black_pawns_row[i - 1] < row_white && black_pawns_row[i - 1] != -1) noOpposingPawns = false;
-            if (i < 7 && black_pawns_row[i + 1] < row_white && black_pawns_row[i + 1] != -1) noOpposingPawns = false;
-            if (black_pawns_row[i] < row_white && black_pawns_row[i] != -1) noOpposingPawns = false;
-
-            if (noOpposingPawns) {
-                bonus += passedPawnBonuses[row_white];
-            }
+        // Isolated pawns.
+        if ((i == 0 || ourRows[i - 1] == -1) && (i == 7 || ourRows[i + 1] == -1)) {
+            num_isolated++;
         }
-        else if (team == -1 && black_pawns_row[i] != -1) {
-            if ((i == 0 || black_pawns_row[i - 1] == -1) && (i == 7 || black_pawns_row[i + 1] == -1)) {
-                num_isolated++;
-            }
 
-            bool noOpposingPawns = true;
-            if (i > 0 && white_pawns_row[i - 1] > row_black) noOpposingPawns = false;
-            if (i < 7 && white_pawns_row[i + 1] > row_black) noOpposingPawns = false;
-            if (white_pawns_row[i] > row_black) noOpposingPawns = false;
+        // Passed pawns, an enemy pawn on this file or the neighbouring ones that is still ahead of the pawn can stop it.
+        bool noOpposingPawns = true;
+        for (int file = max(i - 1, 0); file <= min(i + 1, 7); file++) {
+            int enemyRow = theirRows[file];
+            if (Us == White && enemyRow != -1 && enemyRow < row) noOpposingPawns = false;
+            if (Us == Black && enemyRow > row) noOpposingPawns = false;
+        }
 
-            if (noOpposingPawns) {
-                bonus -= passedPawnBonuses[7 - row_black];
-            }
+        if (noOpposingPawns) {
+            bonus += sign * passedPawnBonuses[(Us == White) ? row : 7 - row];
         }
     }
 
-    penalty = isolatedPawnPenaltyByCount[num_isolated];
-    penalty = (team == 1) ? penalty : -penalty;
-
-    return penalty + bonus;
+    return sign * isolatedPawnPenaltyByCount[num_isolated] + bonus;
 }
 
 int Minimax::evaluation(GameState& state) {
@@ -905,32 +1159,34 @@ int Minimax::evaluation(GameState& state) {
     int black_pawns_row[8] = { -1, -1, -1, -1, -1, -1, -1, -1 };
     int white_pawns_row[8] = { -1, -1, -1, -1, -1, -1, -1, -1 };
 
-    int minor_piece_counter = 0;
-    for (int i = 0; i < 8; i++) {
-        for (int j = 0; j < 8; j++) {
-            int piece = state.board[i][j];
-            if (piece != 0) {
-                if (piece == 6) white_pawns_row[j] = i;
-                else if (piece == -6) black_pawns_row[j] = i;
+    for (int color = WhiteIndex; color <= BlackIndex; color++) {
+        for (int type = 1; type <= 6; type++) {
+            Bitboard pieces = state.pieceBitboards[color][type];
+            int piece = (color == WhiteIndex) ? type : -type;
+            int mgPieceVal = (color == WhiteIndex) ? mgValue[type] : -mgValue[type];
+            int egPieceVal = (color == WhiteIndex) ? egValue[type] : -egValue[type];
 
-                int mgPieceVal = mgValue[abs(piece)], egPieceVal = egValue[abs(piece)];
+            gamePhase += gamephaseInc[type] * popCount(pieces);
 
-                if (piece < 0) {
-                    mgPieceVal *= -1;
-                    egPieceVal *= -1;
-                }
+            // The pieces come out in increasing square order so the pawn rows end up holding the
+            // highest row of each file, the same as scanning the board from top to bottom.
+            while (pieces) {
+                int sq = popLsb(pieces);
+                int i = sq >> 3, j = sq & 7;
+
+                if (piece == 6) white_pawns_row[j] = i;
+                else if (piece == -6) black_pawns_row[j] = i;
 
                 mgEval += get_pcsq_value(i, j, piece, false) + mgPieceVal;
                 egEval += get_pcsq_value(i, j, piece, true) + egPieceVal;
-                gamePhase += gamephaseInc[abs(piece)];
             }
         }
     }
 
     int pawnStructure = 0;
 
-    pawnStructure += evaluate_pawns(1, white_pawns_row, black_pawns_row);
-    pawnStructure += evaluate_pawns(-1, white_pawns_row, black_pawns_row);
+    pawnStructure += evaluate_pawns<White>(white_pawns_row, black_pawns_row);
+    pawnStructure += evaluate_pawns<Black>(white_pawns_row, black_pawns_row);
 
     int mgPhase = min(gamePhase, 24);
     int egPhase = 24 - mgPhase;
@@ -940,182 +1196,571 @@ int Minimax::evaluation(GameState& state) {
 }
 
 
-int Minimax::minimax(GameState& state, int plyRemaining, int depth, int alpha, int beta) {
-    int plyFromRoot = depth - plyRemaining;
+// The ply from the root is passed separately from the remaining depth since pruning
+// and reductions make the remaining depth drop by more than one ply at a time.
+// When excludedMove is set the position is searched without that move, the result is stored under
+// a different key so it doesn't mix with the entry of the full search of the position.
+int Minimax::minimax(GameState& state, int plyRemaining, int plyFromRoot, int alpha, int beta, bool allowNullMove, Move excludedMove) {
     node_counter++;
-
-    if (plyRemaining == 0) {
-        int eval = quiescenceSearch(state, quiescenceMaxDepth, depth, alpha, beta);
+    pvLength[plyFromRoot] = plyFromRoot;
+    selDepth = max(selDepth, plyFromRoot);
+
+    // A position that already happened in the line (or the game) is a draw, the opponent can keep repeating it.
+    // The root is still searched so there's always a move to play.
+    if (plyFromRoot > 0) {
+        // The ply of the line the draw goes back to, the nodes above it up to that ply get their value from the
+        // moves that led to them. The fifty move rule goes back to the start of the game.
+        int drawPly = INT_MAX;
+        if (state.isDrawByFiftyMoves()) drawPly = -1;
+        else if (int distance = state.repetitionDistance()) drawPly = plyFromRoot - distance;
+        if (drawPly != INT_MAX) {
+            for (int ply = max(drawPly + 1, 0); ply < plyFromRoot; ply++) historyDependent[ply] = true;
+            return 0;
+        }
+    }
+    historyDependent[plyFromRoot] = false;
+
+    if (plyRemaining <= 0) {
+        int eval = quiescenceSearch(state, quiescenceMaxDepth, plyFromRoot, alpha, beta);
         //int eval = evaluation(state);
         return eval;
     }
 
+    bool excluding = excludedMove.move != 0;
+    // The root of a MultiPV line after the first one is searched without some of its moves,
+    // so it doesn't store a table entry that would look like the one of the whole root.
+    bool excludingRoot = plyFromRoot == 0 && pvIndex > 0;
+    uint64_t positionKey = excluding ? table->excludedMoveKey(state.zobristKey, excludedMove) : state.zobristKey;
     bool positionInTable = false;
+    Move ttMove;
 
-    int transpositionValue = table->lookupEvaluation(state.zobristKey, plyRemaining, alpha, beta, positionInTable, false);
+    int transpositionValue = table->lookupEvaluation(positionKey, plyRemaining, alpha, beta, positionInTable, false, ttMove);
 
-    if (positionInTable) {
-        if (plyFromRoot == 0) {
-            Transposition pos;
-            table->probeTransposition(state.zobristKey, pos);
-            if (!(abs(pos.value) > 1e9 && pos.IsQuiscence())) {
-                bestMoveThisIteration = pos.move;
-                bestScoreThisIteration = pos.value;
-            }
-        }
+    // The table only cuts off the null window nodes. At the nodes of the principal variation (the root included)
+    // the search goes on so their line is built all the way down instead of stopping at the table entry.
+    bool pvNode = alpha + 1 < beta;
+    if (positionInTable && !pvNode) {
         tableUses++;
         return transpositionValue;
     }
 
-    state.generate_all_possible_moves(state.player);
-    myVector<Move> moves = (state.player == 1) ? state.white_possible_moves : state.black_possible_moves;
-    // Move ordering have proven to be very effective even with that simple heuristic (MVV-LVA)
-    // especially in quiescence search. i really didn't expect it to make that much of a difference but it does.
-    moveOrderer.sortMoves(moves, state.board);
+    myPair<int, int> king = (state.player == 1) ? state.white_king : state.black_king;
+    bool inCheck = state.checked(king.first, king.second, state.player);
+    // The static evaluation is meaningless in check since the position isn't quiet.
+    int staticEval = inCheck ? 0 : evaluation(state);
+    bool mateWindow = abs(alpha) > 1e9 || abs(beta) > 1e9;
 
-    if (moves.empty()) {
-        myPair<int, int> king = (state.player == 1) ? state.white_king : state.black_king;
-        if (state.checked(king.first, king.second, state.player)) {
-            return INT_MIN + 2;
+    // Reverse futility pruning, close to the leaves a position that is way above beta
+    // won't drop below it in the few plies left so it's cut off without searching any move.
+    if (!inCheck && !excluding && plyFromRoot > 0 && !mateWindow && plyRemaining <= reverseFutilityMaxDepth
+        && staticEval - margins.reverseFutility * plyRemaining >= beta) {
+        return beta;
+    }
+
+    // Razoring, a position that is way below alpha with only one or two plies left can hardly be saved
+    // by a quiet move so only the captures are checked by quiescence search.
+    if (!inCheck && !excluding && plyFromRoot > 0 && !mateWindow && plyRemaining <= razoringMaxDepth
+        && staticEval + margins.razoring * plyRemaining < alpha) {
+        int score = quiescenceSearch(state, quiescenceMaxDepth, plyFromRoot, alpha, beta);
+        if (broke_early) return 0;
+        if (score <= alpha) return alpha;
+    }
+
+    // Null move pruning, if the position is still good enough for a beta cut-off after giving the opponent
+    // a free move then an actual move would almost certainly be as well so a reduced search of the pass is enough.
+    // It's wrong in zugzwang where every move makes the position worse, so it's skipped when the side to move only has
+    // pawns left (where zugzwang is common), when in check (passing is illegal), right after another null move
+    // and at high depths the cut-off is verified by a reduced normal search without null moves.
+    if (allowNullMove && !inCheck && plyFromRoot > 0 && plyRemaining >= nullMoveMinDepth && abs(beta) < 1e9
+        && hasNonPawnMaterial(state) && staticEval >= beta) {
+        int reduction = nullMoveReduction + (plyRemaining >= 6 ? 1 : 0);
+
+        playedMoves[plyFromRoot] = Move();
+        state.makeNullMove();
+        int score = -minimax(state, plyRemaining - 1 - reduction, plyFromRoot + 1, -beta, -beta + 1, false);
+        state.unmakeNullMove();
+
+        if (broke_early) return 0;
+
+        if (score >= beta) {
+            if (plyRemaining < nullMoveVerificationDepth) return beta;
+
+            score = searchSamePly(state, plyRemaining - 1 - reduction, plyFromRoot, beta - 1, beta);
+            if (broke_early) return 0;
+            if (score >= beta) return beta;
+        }
+    }
+
+    // Singular extensions, when the table says the tt move beat beta at almost this depth the other moves are
+    // searched at half the depth against a bound a bit below its value. If none of them gets there the tt move
+    // is the only good move (singular) and it's searched a ply deeper, missing something in such a forced line is costly.
+    // If even the bound a bit below is still above beta then at least two moves fail high and the node is cut off (multi-cut).
+    int singularExtension = 0;
+    if (!excluding && plyFromRoot > 0 && plyRemaining >= singularMinDepth && ttMove.move != 0 && plyFromRoot < 2 * searchDepth) {
+        Transposition entry;
+        if (table->probeTransposition(positionKey, entry) && !entry.IsQuiscence() && entry.move.move == ttMove.move
+            && (entry.flag == Transposition::Beta || entry.flag == Transposition::Exact)
+            && entry.depth >= plyRemaining - 3 && abs(entry.value) < 1e9) {
+            int singularBeta = entry.value - singularMargin * plyRemaining;
+            int score = searchSamePly(state, (plyRemaining - 1) / 2, plyFromRoot, singularBeta - 1, singularBeta, ttMove);
+            if (broke_early) return 0;
+
+            if (score < singularBeta) singularExtension = 1;
+            else if (singularBeta >= beta) return beta;
         }
-        else return 0;
     }
 
+    // Move ordering have proven to be very effective even with that simple heuristic (MVV-LVA)
+    // especially in quiescence search. i really didn't expect it to make that much of a difference but it does.
+    Move previousMove = (plyFromRoot > 0) ? playedMoves[plyFromRoot - 1] : Move();
+    Move counterMove = (previousMove.move != 0)
+        ? moveOrderer.counterMoves[square(previousMove.FromX(), previousMove.FromY())][square(previousMove.ToX(), previousMove.ToY())]
+        : Move();
+    MovePicker picker(state, moveOrderer, ttMove, killerMoves[plyFromRoot], false, counterMove);
+
     uint8_t evaluationBound = Transposition::Alpha;
-    Move bestMoveInPos = moves[0];
+    Move bestMoveInPos, move;
+    int movesSearched = 0;
+    // The quiet moves searched before a cut-off get a history malus.
+    Move quietsTried[64];
+    int quietCount = 0;
+
+    // Futility pruning, at the frontier a quiet move can't raise a static evaluation that
+    // is far enough below alpha so those moves aren't searched at all.
+    bool futile = !inCheck && plyFromRoot > 0 && !mateWindow && plyRemaining <= futilityMaxDepth
+        && staticEval + margins.futility * plyRemaining <= alpha;
+
+    while (picker.nextMove(move)) {
+        if (move.move == excludedMove.move) continue;
+        if (excludingRoot && isRootExcluded(move)) continue;
+
+        bool quiet = !move.IsCapture() && !move.IsPromotion();
+        int newDepth = plyRemaining - 1 + (move.move == ttMove.move ? singularExtension : 0);
+        if (futile && quiet && movesSearched > 0 && !picker.isKiller(move)) {
+            state.makeMove(move);
+            myPair<int, int> enemyKing = (state.player == 1) ? state.white_king : state.black_king;
+            bool givesCheck = state.checked(enemyKing.first, enemyKing.second, state.player);
+            state.unMakeMove(move);
+            if (!givesCheck) continue;
+        }
+        // Pruned moves aren't counted so they don't push the later moves into the reductions.
+        if (movesSearched++ == 0) bestMoveInPos = move;
+
+        // Captures, promotions and killers are the moves most likely to be good so they are never reduced,
+        // neither are moves out of check since they're usually the only few legal ones.
+        bool reducible = movesSearched > lmrFullDepthMoves && plyRemaining >= lmrMinDepth && !inCheck
+            && quiet && !picker.isKiller(move);
 
-    for (int i = 0; i < moves.size(); i++) {
+        // Moves with a good history are reduced less and the ones with a bad history more.
+        int historyAdjustment = quiet ? moveOrderer.historyScore(state.player, move) / (MoveOrderer::HistoryMax / 2) : 0;
 
-        state.makeMove(moves[i]);
-        int score = -minimax(state, plyRemaining - 1, depth, -beta, -alpha);
-        state.unMakeMove(moves[i]);
+        if (plyFromRoot == 0 && threadId == 0 && sendInfo && duration.count() >= currMoveInfoMs) {
+            sendInfo("info depth " + to_string(searchDepth) + " currmove " + moveToUci(move)
+                + " currmovenumber " + to_string(movesSearched + pvIndex));
+        }
+
+        playedMoves[plyFromRoot] = move;
+        bool dependentBefore = historyDependent[plyFromRoot];
+        historyDependent[plyFromRoot] = false;
+        state.makeMove(move);
+        int score;
+        // Principal variation search, the first move is expected to be the best so the others are only searched
+        // with a null window to prove they are worse which is cheaper, if one of them turns out better
+        // than alpha it's searched again with the full window to get its actual score.
+        if (movesSearched == 1) {
+            score = -minimax(state, newDepth, plyFromRoot + 1, -beta, -alpha);
+        }
+        else {
+            // Late move reductions, quiet moves that come late in the ordering rarely turn out to be the best
+            // so they are first searched shallower and only searched again at the full depth if they beat alpha.
+            // Moves that give check are left alone since they often lead to something tactical.
+            int reduction = 0;
+            if (reducible) {
+                myPair<int, int> enemyKing = (state.player == 1) ? state.white_king : state.black_king;
+                if (!state.checked(enemyKing.first, enemyKing.second, state.player)) {
+                    reduction = lateMoveReductions[min(plyRemaining, 63)][min(movesSearched, 63)] - historyAdjustment;
+                    reduction = max(0, min(reduction, newDepth - 1));
+                }
+            }
+
+            score = -minimax(state, newDepth - reduction, plyFromRoot + 1, -alpha - 1, -alpha);
+            if (reduction > 0 && score > alpha)
+                score = -minimax(state, newDepth, plyFromRoot + 1, -alpha - 1, -alpha);
+            if (score > alpha && score < beta)
+                score = -minimax(state, newDepth, plyFromRoot + 1, -beta, -alpha);
+        }
+        state.unMakeMove(move);
+        // A cut-off only depends on the move that caused it.
+        bool moveDependent = historyDependent[plyFromRoot];
+        historyDependent[plyFromRoot] = dependentBefore || moveDependent;
 
         // Break if the time limit was exceeded.
-        if (timeLimitExceeded(start_time, duration, depth)) { 
+        if (timeLimitExceeded(searchDepth)) { 
             broke_early = true; 
             return 0; 
         }
 
         // A Beta-cutoff meaning the opponent won't choose this move as they have a better option.
         if (score >= beta) {
-            table->storeTransposition(state.zobristKey, Transposition::Beta, plyRemaining, beta, moves[i]);
+            if (quiet) updateQuietStats(state, move, previousMove, quietsTried, quietCount, plyRemaining, plyFromRoot);
+            // At the root this only happens inside an aspiration window, the move is better than expected.
+            if (plyFromRoot == 0) {
+                bestMoveThisIteration = move;
+                bestScoreThisIteration = beta;
+                updatePv(move, plyFromRoot);
+            }
+            if (!excludingRoot && !(moveDependent && beta == 0))
+                table->storeTransposition(positionKey, Transposition::Beta, plyRemaining, beta, move, tableStats);
             return beta;
         }
+        if (quiet && quietCount < 64) quietsTried[quietCount++] = move;
 
         // Found a new move that is better than the current best.
         if (score > alpha) {
             alpha = score;
             evaluationBound = Transposition::Exact;
-            bestMoveInPos = moves[i];
+            bestMoveInPos = move;
+            updatePv(move, plyFromRoot);
 
             // Saves the moves to be sorted and assigned to best move after the search is finished.
             if (plyFromRoot == 0) {
-                bestMoveThisIteration = moves[i];
+                bestMoveThisIteration = move;
                 bestScoreThisIteration = score;
             }
         }
     }
 
+    // No legal moves means either a checkmate or a stalemate, unless the only one was excluded.
+    if (movesSearched == 0) {
+        if (excluding || excludingRoot) return alpha;
+        if (inCheck) return INT_MIN + 2;
+        else return 0;
+    }
+
     if (abs(alpha) > 1e9) alpha = (alpha > 0) ? alpha - 1 : alpha + 1;
-    table->storeTransposition(state.zobristKey, evaluationBound, plyRemaining, alpha, bestMoveInPos);
+    if (!excludingRoot && !(historyDependent[plyFromRoot] && alpha == 0))
+        table->storeTransposition(positionKey, evaluationBound, plyRemaining, alpha, bestMoveInPos, tableStats);
     return alpha;
 }
 
+// Searches the node again at its own ply (without null moves), used to verify a null move cut-off
+// and for the singular search without the tt move.
+// The inner search writes over the killers, the played move and the line of the ply, they're
+// put back afterwards so the node goes on as if it never happened. Its result can still decide the node's value, so when it
+// depended on the moves that led to the node the node does too.
+int Minimax::searchSamePly(GameState& state, int plyRemaining, int plyFromRoot, int alpha, int beta, Move excludedMove) {
+    Move killers[2] = { killerMoves[plyFromRoot][0], killerMoves[plyFromRoot][1] };
+    Move played = playedMoves[plyFromRoot];
+    bool dependent = historyDependent[plyFromRoot];
+
+    int score = minimax(state, plyRemaining, plyFromRoot, alpha, beta, false, excludedMove);
+    historyDependent[plyFromRoot] = historyDependent[plyFromRoot] || dependent;
+
+    killerMoves[plyFromRoot][0] = killers[0];
+    killerMoves[plyFromRoot][1] = killers[1];
+    playedMoves[plyFromRoot] = played;
+    pvLength[plyFromRoot] = plyFromRoot;
+    return score;
+}
+
+// Checks if the side to move has any piece other than pawns and the king.
+bool Minimax::hasNonPawnMaterial(GameState& state) {
+    const Bitboard* pieces = state.pieceBitboards[colorIndex(state.player)];
+    return (pieces[2] | pieces[3] | pieces[4] | pieces[5]) != 0;
+}
+
+// The line of a node is its new best move followed by the line of the child below it.
+void Minimax::updatePv(Move move, int ply) {
+    pvTable[ply][ply] = move;
+    for (int i = ply + 1; i < pvLength[ply + 1]; i++) pvTable[ply][i] = pvTable[ply + 1][i];
+    pvLength[ply] = max(pvLength[ply + 1], ply + 1);
+}
+
+// Keeps the move, score and line the root search just found, the line is only the move
+// if the search didn't get to build one.
+void Minimax::recordLine(RootLine& line) {
+    line.move = bestMoveThisIteration, line.score = bestScoreThisIteration, line.pvLength = 0;
+    if (pvLength[0] > 0 && pvTable[0][0].move == line.move.move) {
+        for (int i = 0; i < min(pvLength[0], MaxPvLength); i++) line.pv[line.pvLength++] = pvTable[0][i];
+    }
+    else line.pv[line.pvLength++] = line.move;
+}
+
+// Checks if a root move is the move of one of the lines already found in this iteration.
+bool Minimax::isRootExcluded(Move move) {
+    for (int i = 0; i < pvIndex; i++) {
+        if (iterationLines[i].move.move == move.move) return true;
+    }
+    return false;
+}
+
+// Rewards a quiet move that caused a beta cut-off, it becomes a killer of the ply and the counter move of the
+// opponent's previous move and gets a history bonus while the quiet moves searched before it get a malus.
+void Minimax::updateQuietStats(GameState& state, Move bestQuiet, Move previousMove, Move* quietsTried, int quietCount, int plyRemaining, int plyFromRoot) {
+    storeKiller(bestQuiet, plyFromRoot);
+
+    if (previousMove.move != 0)
+        moveOrderer.counterMoves[square(previousMove.FromX(), previousMove.FromY())][square(previousMove.ToX(), previousMove.ToY())] = bestQuiet;
+
+    int bonus = min(16 * plyRemaining * plyRemaining, 1600);
+    moveOrderer.updateHistory(state.player, bestQuiet, bonus);
+    for (int i = 0; i < quietCount; i++)
+        moveOrderer.updateHistory(state.player, quietsTried[i], -bonus);
+}
+
+// Forgets everything learned about the moves, used when a new game starts.
+void Minimax::clearHistory() {
+    moveOrderer.clearHistory();
+    for (int i = 0; i < helpers.size(); i++) helpers[i]->moveOrderer.clearHistory();
+}
+
+// Keeps the two most recent killer moves of a ply, the newest one in the first slot.
+void Minimax::storeKiller(Move move, int ply) {
+    if (killerMoves[ply][0].move == move.move) return;
+    killerMoves[ply][1] = killerMoves[ply][0];
+    killerMoves[ply][0] = move;
+}
+
+void Minimax::resetSearch() {
+    node_counter = 0, Q_nodes = 0, nextClockCheck = clockCheckNodes; bestScore = INT_MIN + 1, bestScoreThisIteration + INT_MIN + 1, tableUses = 0;
+    completedDepth = 0, nextInfoMs = infoIntervalMs, duration = chrono::milliseconds(0);
+    publishedNodes = 0;
+    tableStats = TableStats();
+    for (int i = 0; i < 256; i++) killerMoves[i][0] = killerMoves[i][1] = Move();
+    moveOrderer.ageHistory();
+}
+
 Move Minimax::iterative_deepening(GameState& state) {
-    node_counter = 0, Q_nodes = 0; bestScore = INT_MIN + 1, bestScoreThisIteration + INT_MIN + 1, tableUses = 0;
+    resetSearch();
+    table->newSearch();
     start_time = chrono::steady_clock::now();
+
+    // Without a legal move the game is already over, the score is a mate in 0 when in check and a draw otherwise.
+    state.generate_all_possible_moves(state.player);
+    if (((state.player == 1) ? state.white_possible_moves.size() : state.black_possible_moves.size()) == 0) {
+        myPair<int, int> king = (state.player == 1) ? state.white_king : state.black_king;
+        bool inCheck = state.checked(king.first, king.second, state.player);
+        bestMove = Move();
+        bestScore = inCheck ? INT_MIN + 2 : 0;
+        pvLines[0] = RootLine();
+        pvLines[0].score = bestScore;
+        reached_depth = 0;
+        if (sendInfo) sendInfo(string("info depth 0 score ") + (inCheck ? "mate 0" : "cp 0"));
+        return bestMove;
+    }
+
+    // The helpers search their own copies of the position while the main thread searches the original.
+    vector<thread> threads;
+    for (int i = 0; i < helpers.size(); i++) {
+        Minimax* helper = helpers[i];
+        helper->resetSearch();
+        helper->start_time = start_time;
+        helper->margins = margins;
+        helper->maxDepth = maxDepth;
+        threads.emplace_back([helper, state]() mutable { helper->search(state); });
+    }
+
+    search(state);
+
+    stopFlag = true;
+    for (thread& t : threads) t.join();
+
+    // The result of the thread that finished the deepest iteration is played, the main thread wins ties.
+    Minimax* chosen = nullptr;
+    for (int i = 0; i < helpers.size(); i++) {
+        Minimax* helper = helpers[i];
+        // A proven mate is only replaced by a shorter one, however deep the other thread got.
+        bool better = (helper->bestScore > 1e9 || bestScore > 1e9) ? helper->bestScore > bestScore
+            : helper->completedDepth > completedDepth || (helper->completedDepth == completedDepth && helper->bestScore > bestScore);
+        if (better) {
+            chosen = helper;
+            completedDepth = helper->completedDepth;
+            bestMove = helper->bestMove;
+            bestScore = helper->bestScore;
+            pvLines[0] = helper->pvLines[0];
+        }
+    }
+    // The main thread only reported its own lines, the line of a helper that's played is sent as the last one
+    // so the pv agrees with the best move and the ponder move.
+    if (chosen != nullptr) {
+        selDepth = chosen->selDepth;
+        reportLines(completedDepth, 1);
+    }
+
+    table->stats.add(tableStats);
+    for (int i = 0; i < helpers.size(); i++) {
+        Minimax* helper = helpers[i];
+        table->stats.add(helper->tableStats);
+        node_counter += helper->node_counter;
+        Q_nodes += helper->Q_nodes;
+        tableUses += helper->tableUses;
+    }
+    reached_depth = max(reached_depth, completedDepth);
+
+    return bestMove;
+}
+
+// The iterative deepening loop run by every thread, odd helper threads start one iteration ahead
+// so at any moment the threads are spread over two depths and fill the table for each other.
+void Minimax::search(GameState& state) {
     state.generate_all_possible_moves(state.player);
 
     if (state.player == 1) bestMoveThisIteration = state.white_possible_moves[0];
     else bestMoveThisIteration = state.black_possible_moves[0];
+    bestMove = bestMoveThisIteration;
+
+    // The helpers only look for the best move, there can't be more lines than legal moves.
+    int legalMoves = (state.player == 1) ? state.white_possible_moves.size() : state.black_possible_moves.size();
+    lineCount = (threadId == 0) ? max(1, min(multiPV, legalMoves)) : 1;
+    for (int i = 0; i < lineCount; i++) pvLines[i] = RootLine();
+    pvIndex = 0;
+
+    int depth = 1 + (threadId & 1); broke_early = false;
+
+    while (depth <= maxDepth) {
+        selDepth = 0;
+        for (pvIndex = 0; pvIndex < lineCount; pvIndex++) {
+            // Aspiration windows, the score is expected to stay close to the previous iteration's so the search
+            // starts with a small window around it which prunes a lot more, when the score falls outside the window
+            // is widened on that side and the iteration is searched again until the score is exact.
+            int previousScore = pvLines[pvIndex].score;
+            if (pvLines[pvIndex].move.move != 0) bestMoveThisIteration = pvLines[pvIndex].move;
+            int alpha = INT_MIN + 1, beta = INT_MAX, delta = aspirationWindow;
+            if (depth >= 4 && abs(previousScore) < 1e9) {
+                alpha = previousScore - delta;
+                beta = previousScore + delta;
+            }
 
-    int depth = 1; broke_early = false;
-
-    while (depth <= 255) {
-        int score = minimax(state, depth, depth, INT_MIN + 1, INT_MAX);
+            while (true) {
+                searchDepth = depth;
+                int score = minimax(state, depth, 0, alpha, beta);
+                if (stop->load(memory_order_relaxed) || broke_early) break;
 
-        if (timeLimitExceeded(start_time, duration, depth)) { broke_early = true; }
+                delta *= 2;
+                if (score <= alpha) alpha = (delta > 1000) ? INT_MIN + 1 : max(score - delta, INT_MIN + 1);
+                else if (score >= beta) beta = (delta > 1000) ? INT_MAX : min(score + delta, INT_MAX);
+                else break;
+            }
 
-        if (bestScoreThisIteration > 1e9) {
-            broke_early = true;
-            bestMove = bestMoveThisIteration;
-            bestScore = bestScoreThisIteration;
+            if (stop->load(memory_order_relaxed)) broke_early = true;
+            if (broke_early) break;
+            recordLine(iterationLines[pvIndex]);
         }
 
+        // The lines are sorted by their scores (a later line can come out better when the search is unstable)
+        // and the best one is the move of the iteration.
         if (!broke_early) {
+            for (int i = 1; i < lineCount; i++) {
+                RootLine line = iterationLines[i];
+                int j = i;
+                for (; j > 0 && iterationLines[j - 1].score < line.score; j--) iterationLines[j] = iterationLines[j - 1];
+                iterationLines[j] = line;
+            }
+            for (int i = 0; i < lineCount; i++) pvLines[i] = iterationLines[i];
+            bestMoveThisIteration = pvLines[0].move;
+            bestScoreThisIteration = pvLines[0].score;
+            if (threadId == 0) reportLines(depth, lineCount);
+        }
+
+        // A mate found by the first line is proven even when the iteration didn't finish, so it's kept like a finished one.
+        bool mateFound = bestScoreThisIteration > 1e9 && (pvIndex == 0 || !broke_early);
+        if (mateFound && broke_early) {
+            recordLine(pvLines[0]);
+            if (threadId == 0) reportLines(depth, 1);
+        }
+
+        if (!broke_early || mateFound) {
             bestMove = bestMoveThisIteration;
             bestScore = bestScoreThisIteration;
+            completedDepth = depth;
         }
-        else{
-            time_in_seconds = duration.count() / 1000.0;
-            break;
-        }
+        // The iteration is kept even if the time ran out right after it finished,
+        // and searching deeper can't find anything better than a mate.
+        if (broke_early || mateFound || timeLimitExceeded(depth, true)) break;
         depth++;
     }
-    reached_depth = depth - broke_early;
-    return bestMove;
+    pvIndex = 0;
+    reached_depth = min(depth, maxDepth) - broke_early;
+    duration = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start_time);
+    time_in_seconds = duration.count() / 1000.0;
 }
 
 
-int Minimax::quiescenceSearch(GameState& state, int plyRemaining, int mainSearchDepth, int alpha, int beta) {
+int Minimax::quiescenceSearch(GameState& state, int plyRemaining, int plyFromRoot, int alpha, int beta) {
     int staticEval = evaluation(state);
     Q_nodes++;
     node_counter++;
+    selDepth = max(selDepth, plyFromRoot);
 
     if (plyRemaining == 0) return staticEval;
 
-    if (staticEval >= beta) {
-        return beta;
-    }
-    if (staticEval > alpha) {
-        alpha = staticEval;
+    // The side to move can't stand pat when in check since it has to get out of it,
+    // all the evasions are searched instead so a checkmate can still be recognized.
+    myPair<int, int> king = (state.player == 1) ? state.white_king : state.black_king;
+    bool inCheck = state.checked(king.first, king.second, state.player);
+
+    if (!inCheck) {
+        if (staticEval >= beta) {
+            return beta;
+        }
+        if (staticEval > alpha) {
+            alpha = staticEval;
+        }
     }
 
     bool positionInTable = false;
+    Move ttMove;
 
-    int transpositionValue = table->lookupEvaluation(state.zobristKey, plyRemaining, alpha, beta, positionInTable, true);
+    int transpositionValue = table->lookupEvaluation(state.zobristKey, plyRemaining, alpha, beta, positionInTable, true, ttMove);
 
     if (positionInTable) {
         tableUses++;
         return transpositionValue;
     }
 
-    state.generate_all_possible_moves(state.player);
-    myVector<Move> moves = (state.player == 1) ? state.white_possible_moves : state.black_possible_moves;
-    moveOrderer.sortMoves(moves, state.board);
-
-    if (moves.empty()) {
-        myPair<int, int> king = (state.player == 1) ? state.white_king : state.black_king;
-        if (state.checked(king.first, king.second, state.player)) {
-            return INT_MIN + 2;
-        }
-        else return 0;
-    }
+    // Only captures are generated unless the king is in check.
+    MovePicker picker(state, moveOrderer, ttMove, nullptr, !inCheck);
 
     uint8_t evaluationBound = Transposition::QAlpha;
-    Move bestMoveInPos = moves[0];
+    Move bestMoveInPos, move;
+    int movesSearched = 0;
 
-    for (int i = 0; i < moves.size(); i++) {
+    while (picker.nextMove(move)) {
+        if (movesSearched++ == 0) bestMoveInPos = move;
 
-        if (!moves[i].IsCapture()) continue;
+        // Delta pruning, a capture that can't raise alpha even after winning the captured piece
+        // with a margin for the positional gain isn't worth searching.
+        if (!inCheck && move.IsCapture() && abs(alpha) < 1e9) {
+            int captured = move.IsEnPassant() ? 6 : abs(state.board[move.ToX()][move.ToY()]);
+            int gain = mgValue[captured] + (move.IsPromotion() ? mgValue[2] - mgValue[6] : 0);
+            if (staticEval + gain + margins.delta <= alpha) continue;
+        }
 
-        state.makeMove(moves[i]);
-        int score = -quiescenceSearch(state, plyRemaining - 1, mainSearchDepth, -beta, -alpha);
-        state.unMakeMove(moves[i]);
+        state.makeMove(move);
+        int score = -quiescenceSearch(state, plyRemaining - 1, plyFromRoot + 1, -beta, -alpha);
+        state.unMakeMove(move);
 
         if (score >= beta) {
-            table->storeTransposition(state.zobristKey, Transposition::QBeta, plyRemaining, beta, moves[i]);
+            table->storeTransposition(state.zobristKey, Transposition::QBeta, plyRemaining, beta, move, tableStats);
             return beta;
         }
         if (score > alpha) {
             alpha = score;
             evaluationBound = Transposition::QExact;
-            bestMoveInPos = moves[i];
+            bestMoveInPos = move;
         }
     }
 
+    if (inCheck && movesSearched == 0) return INT_MIN + 2;
+    // Without any capture the position could be a stalemate, it's only a draw if there's no quiet move either.
+    if (!inCheck && picker.moves.size() == 0) {
+        MoveList quiets;
+        state.generate_moves(quiets, GameState::GenQuiets);
+        if (quiets.size() == 0) return 0;
+    }
+
     if (abs(alpha) > 1e9) alpha = (alpha > 0) ? alpha - 1 : alpha + 1;
-    table->storeTransposition(state.zobristKey, evaluationBound, plyRemaining, alpha, bestMoveInPos);
+    table->storeTransposition(state.zobristKey, evaluationBound, plyRemaining, alpha, bestMoveInPos, tableStats);
     return alpha;
 }
 
@@ -1157,81 +1802,76 @@ string Minimax::displayStatistics(GameState& state) {
     return output;
 }
 
-void Minimax::setTimeLimit(int time) {
-    time_limit = time;
+// Sets up the next search, the stop flag is cleared here instead of when the search starts
+// so a stop that arrives before the search thread gets going isn't lost.
+void Minimax::setLimits(SearchLimits newLimits) {
+    stopFlag = false;
+    limits = newLimits;
+    pondering = limits.ponder;
+    ponderHitMs = 0;
+    ponderHitReceived = false;
+    maxDepth = (limits.depth > 0) ? min(limits.depth, 255) : 255;
+    // A mate in n moves is n of our moves and n - 1 of the opponent's.
+    if (limits.mate > 0) maxDepth = min(maxDepth, 2 * limits.mate - 1);
 }
 
+// Can be called from another thread, the searching threads see it at their next node.
+void Minimax::stopSearch() {
+    stopFlag.store(true, memory_order_relaxed);
+}
 
+// The opponent played the expected move, the ponder search goes on as a normal search
+// that gets its whole time limit from now on. Called from the UCI thread so it only leaves
+// a note for the search thread, which owns the start time.
+void Minimax::ponderHit() {
+    ponderHitReceived.store(true, memory_order_relaxed);
+}
 
-int node_counter = 0, capture_counter = 0, check_counter = 0, EP_counter = 0, promotion_counter = 0, castle_counter = 0;
-
-void perftResults(GameState& state, int depth, int startDepth) {
-    if (depth == 0) {
-        node_counter++;
-        return;
-    }
-
-    if (state.player == 1) {
-        state.generate_all_possible_moves(1);
-        myVector<Move> Possible = state.white_possible_moves;
-        for (int i = 0; i < Possible.size(); i++) {
-            Move move = Possible[i];
-            state.makeMove(move);
-
-            if (depth == 1) {
-                if (state.capturedPiece() != 0) {
-                    capture_counter++;
-                }
-
-                if (move.IsCastle()) castle_counter++;
-                if (move.IsEnPassant()) { EP_counter++; capture_counter++; }
-                if (move.IsPromotion()) promotion_counter+=4;
+// The reply expected after the best move, it's the second move of the principal variation. When the line
+// was cut after the best move it's the best move stored in the table for the position after it
+// (if it's still there), an empty move when there's none.
+Move Minimax::ponderMove(GameState& state, Move best) {
+    if (best.move == 0) return Move();
+    if (pvLines[0].pvLength > 1 && pvLines[0].pv[0].move == best.move) return pvLines[0].pv[1];
+
+    Transposition entry;
+    Move reply;
+    state.makeMove(best);
+    if (table->probeTransposition(state.zobristKey, entry) && entry.move.move != 0 && state.is_legal_move(entry.move))
+        reply = entry.move;
+    state.unMakeMove(best);
+    return reply;
+}
 
+// Sends an info line for the first lines of the finished iteration, the best line first.
+void Minimax::reportLines(int depth, int lines) {
+    if (!sendInfo) return;
 
-                if (state.checked(state.black_king.first, state.black_king.second, -1)) {
-                    check_counter++;
-                }
-            }
+    long long elapsed = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start_time).count();
+    long long nodes = totalNodes();
+    string stats = " nodes " + to_string(nodes) + " nps " + to_string(nodes * 1000 / max(elapsed, 1LL))
+        + " hashfull " + to_string(table->hashfull()) + " time " + to_string(elapsed);
 
-            perftResults(state, depth - 1, startDepth);
-            state.unMakeMove(move);
-        }
+    for (int i = 0; i < lines; i++) {
+        int score = pvLines[i].score;
+        string scoreText = (abs(score) > 1e9) ? "mate " + to_string(mateInMoves(score)) : "cp " + to_string(score);
+        string pv = "";
+        for (int j = 0; j < pvLines[i].pvLength; j++) pv += " " + moveToUci(pvLines[i].pv[j]);
+        sendInfo("info depth " + to_string(depth) + " seldepth " + to_string(selDepth) + " multipv " + to_string(i + 1)
+            + " score " + scoreText + stats + " pv" + pv);
     }
-    else {
-        state.generate_all_possible_moves(-1);
-        myVector<Move> Possible = state.black_possible_moves;
-        for (int i = 0; i < Possible.size(); i++) {
-            Move move = Possible[i];
-            state.makeMove(move);
-
-            if (depth == 1) {
-                if (state.capturedPiece() != 0) {
-                    capture_counter++;
-                }
-
-                if (move.IsCastle()) castle_counter++;
-                if (move.IsEnPassant()) { EP_counter++; capture_counter++; }
-                if (move.IsPromotion()) promotion_counter+=4;
-
-
-                if (state.checked(state.white_king.first, state.white_king.second, 1)) {
-                    check_counter++;
-                }
-            }
+}
 
-            perftResults(state, depth - 1, startDepth);
-            state.unMakeMove(move);;
-        }
-    }
+// The nodes of the main thread and the last count published by every helper.
+long long Minimax::totalNodes() {
+    long long nodes = node_counter;
+    for (int i = 0; i < helpers.size(); i++) nodes += helpers[i]->publishedNodes.load(memory_order_relaxed);
+    return nodes;
+}
 
-    if (depth == startDepth) {
-        cerr << "Depth: " << startDepth << endl;
-        cerr << "Nodes: " << node_counter << endl;
-        cerr << "Captures: " << capture_counter << endl;
-        cerr << "EP: " << EP_counter << endl;
-        cerr << "Castles: " << castle_counter << endl;
-        cerr << "Promotions: " << promotion_counter << endl;
-        cerr << "Checks: " << check_counter << endl;
-        node_counter = 0, capture_counter = 0, check_counter = 0, EP_counter = 0, promotion_counter = 0, castle_counter = 0;
-    }
+// The number of moves until the mate of a mate score, negative when the side to move is getting mated.
+// The mated position scores INT_MIN + 2 and every ply towards the root moves the score one closer to zero.
+int Minimax::mateInMoves(int score) {
+    int plies = INT_MAX - abs(score);
+    return (score > 0) ? (plies + 1) / 2 : -(plies + 1) / 2;
 }
\ No newline at end of file
@@ -1,7 +1,11 @@
 #pragma once
 #include<iostream>
 #include <chrono>
+#include <climits>
+#include <atomic>
+#include <functional>
 #include "dataStructures.h"
+#include "bitboard.h"
 #include "TranspositionTable.h"
 
 using namespace std;
@@ -9,6 +13,8 @@ using namespace std;
 void printBits(uint16_t);
 bool in_board(int x, int y);
 string to_algebraic(int from_x, int from_y, int target_x, int target_y);
+string moveToUci(Move move);
+bool parseNumber(string text, long long& value);
 myPair<int, int> to_index(char file, char rank);
 char match_to_char(int piece);
 
@@ -25,6 +31,28 @@ struct GameState {
     TranspositionTable* table;
     myVector<uint64_t> zobristKeys;
     uint64_t zobristKey;
+    // The plies since the last capture or pawn move (and the clocks before every move made), positions before
+    // that can't repeat and at 100 the game is drawn by the fifty move rule. The full move number starts at 1
+    // and goes up after every black move.
+    int halfmoveClock = 0, fullmoveNumber = 1;
+    myVector<int> halfmoveClocks;
+
+    // Bitboards kept in sync with the board array by makeMove and unMakeMove.
+    // They are indexed by [color][piece type] where the color is 0 for white and 1 for black
+    // (like the zobrist piece keys) and the type 0 slot holds all the pieces of that color.
+    Bitboard pieceBitboards[2][7] = {};
+    Bitboard occupied = 0;
+
+    // Filled by find_checks_and_pins at the start of move generation.
+    int kingSquare = 0;
+    Bitboard checkers = 0, pinned = 0, checkMask = 0;
+
+    // The kinds of moves the generators can be limited to.
+    static constexpr int GenAll = 0;
+    static constexpr int GenCaptures = 1;
+    static constexpr int GenQuiets = 2;
+    int generationType = GenAll;
+    Bitboard generationMask = ~0ULL;
 
 
     // The first four bits of the currentGameState are the castling rights.
@@ -35,9 +63,15 @@ struct GameState {
     static constexpr uint16_t WQueenSide = 2;
     static constexpr uint16_t WKingSide = 1;
 
-    // Moves are stored in a dynamic array containing 16 bit numbers describing the pseudo-legal
+    // Piece values used by the static exchange evaluation, indexed by piece type.
+    // The king is worth more than everything else together so it's never traded.
+    static constexpr int seeValue[7] = { 0, 20000, 900, 500, 320, 330, 100 };
+
+    // Moves are stored in a fixed size list containing 16 bit numbers describing the legal
     // moves that the specific white or black player can do.
-    myVector<Move> white_possible_moves, black_possible_moves;
+    MoveList white_possible_moves, black_possible_moves;
+    // The list the generators are currently pushing to.
+    MoveList* generatedMoves = nullptr;
 
     // The pieces are encoded as follows:
     //// 1 -> king
@@ -50,19 +84,36 @@ struct GameState {
 
     void initialize_board(TranspositionTable& Ttable);
     void initialize_board(TranspositionTable& Ttable, string FEN);
-    void pawn_moves(int x, int y, int team);
-    void rook_moves(int x, int y, int team);
-    void king_moves(int x, int y, int team);
-    void knight_moves(int x, int y, int team);
-    void bishop_moves(int x, int y, int team);
-    void queen_moves(int x, int y, int team);
-    void generate_piece_moves(int x, int y, int team, int type);
-    void generate_all_possible_moves(int team);
+    void initialize_bitboards();
+    void putPiece(int x, int y, int piece);
+    void removePiece(int x, int y);
+    void movePiece(int fromX, int fromY, int toX, int toY);
+    void replacePiece(int x, int y, int piece);
+    void add_move(Move& move);
+    Bitboard legal_targets(int sq);
+    template<Color Us> void find_checks_and_pins();
+    void set_generation_type(int type);
+    template<Color Us> void pawn_moves(Bitboard pawns);
+    template<Color Us, int Type> void piece_moves(Bitboard pieces);
+    template<Color Us> void king_moves(int sq);
+    template<Color Us> void generate_piece_moves(int sq, int type);
+    template<Color Us> void generate_color_moves();
+    void generate_all_possible_moves(int team, int type = GenAll);
+    void generate_moves(MoveList& moves, int type = GenAll);
+    bool is_legal_move(Move move);
     void display_possible_moves();
+    Bitboard attackers(int sq, int color, Bitboard occupancy);
     bool checked(int kingx, int kingy, int type);
+    int see(Move move);
+    bool isRepetition();
+    int repetitionDistance();
+    bool isDrawByFiftyMoves();
     void makeMove(Move& move);
     void unMakeMove(Move& move);
-    bool check_legal(Move& move);
+    void makeNullMove();
+    void unmakeNullMove();
+    template<Color Us> void make_move(Move& move);
+    template<Color Us> void unmake_move(Move& move);
     bool checkMate(int team);
     bool staleMate(int team);
     string show();
@@ -73,6 +124,67 @@ struct GameState {
 };
 
 
+// Hands out the moves of a position one at a time in the order they are most likely to cause a cut-off.
+// Every group of moves is only generated and scored when the search actually gets to it, since most
+// nodes are cut off after the first one or two moves.
+//// 1 -> the transposition table move
+//// 2 -> captures that don't lose material by SEE, picked best first by MVV-LVA
+//// 3 -> the killer moves of this ply
+//// 4 -> the remaining quiet moves, promotions first and then by their history
+//// 5 -> the captures that lose material, dropped altogether when only captures are picked
+struct MovePicker {
+    static constexpr int TTMoveStage = 0;
+    static constexpr int GenerateCapturesStage = 1;
+    static constexpr int CapturesStage = 2;
+    static constexpr int KillersStage = 3;
+    static constexpr int GenerateQuietsStage = 4;
+    static constexpr int QuietsStage = 5;
+    static constexpr int BadCapturesStage = 6;
+    static constexpr int DoneStage = 7;
+
+    GameState& state;
+    MoveOrderer& moveOrderer;
+    Move ttMove, killers[2], counterMove;
+    MoveList moves;
+    Move badCaptures[MoveList::Capacity];
+    int stage = TTMoveStage, index = 0, killerIndex = 0, badCaptureCount = 0, badCaptureIndex = 0;
+    bool capturesOnly;
+
+    MovePicker(GameState& state, MoveOrderer& orderer, Move ttMove, Move* killers, bool capturesOnly = false, Move counterMove = Move());
+    bool nextMove(Move& move);
+    bool pickBest(Move& move);
+    bool alreadyPicked(Move& move);
+    bool isKiller(Move& move);
+};
+
+// The margins in centipawns of the pruning done on the static evaluation near the leaves,
+// bigger margins prune less and are safer. They can be changed with setoption.
+struct PruningMargins {
+    // A node is cut off when the static evaluation is above beta by this much per remaining ply.
+    int reverseFutility = 90;
+    // Quiet moves are skipped when the static evaluation is below alpha by this much per remaining ply.
+    int futility = 120;
+    // The node drops into quiescence search when the static evaluation is below alpha by this much per remaining ply.
+    int razoring = 250;
+    // Captures in quiescence search are skipped when winning the piece plus this margin can't raise alpha.
+    int delta = 200;
+};
+
+// What a search is allowed to do, filled from the go command. A limit of 0 means there's no such limit,
+// the search stops at whichever limit it reaches first or when it's stopped.
+struct SearchLimits {
+    int depth = 0;
+    long long nodes = 0;
+    // The time in milliseconds the search may use, from movetime or picked from the clocks.
+    int timeMs = 0;
+    // Look for a mate in this many moves, it limits the depth to as many plies as the mate needs.
+    int mate = 0;
+    // Only stopped by the stop command.
+    bool infinite = false;
+    // Searching the position after the expected reply on the opponent's time, the time limit
+    // only starts counting once the opponent actually plays that move (ponderhit).
+    bool ponder = false;
+};
 
 struct Minimax {
 private:
@@ -84,11 +196,85 @@ private:
     static constexpr int passedPawnBonuses[7] = { 0, 120, 80, 50, 30, 15, 15 };
     static constexpr int isolatedPawnPenaltyByCount[9] = { 0, -10, -25, -50, -75, -75, -75, -75, -75 };
 
+    // The half width of the first aspiration window in centipawns, it doubles after every fail.
+    static constexpr int aspirationWindow = 25;
+    // Null move pruning searches the pass this many plies shallower (one more from 6 plies remaining),
+    // only from nullMoveMinDepth plies remaining and its cut-offs are verified from nullMoveVerificationDepth.
+    static constexpr int nullMoveReduction = 2;
+    static constexpr int nullMoveMinDepth = 3;
+    static constexpr int nullMoveVerificationDepth = 10;
+    // Late move reductions start after the first lmrFullDepthMoves moves of nodes with at least lmrMinDepth plies remaining.
+    static constexpr int lmrFullDepthMoves = 3;
+    static constexpr int lmrMinDepth = 3;
+    // The pruning on the static evaluation is only done this close to the leaves.
+    static constexpr int reverseFutilityMaxDepth = 6;
+    static constexpr int futilityMaxDepth = 3;
+    static constexpr int razoringMaxDepth = 2;
+    // Singular extensions are tried from singularMinDepth plies remaining, the other moves have to stay
+    // singularMargin centipawns per remaining ply below the value of the tt move.
+    static constexpr int singularMinDepth = 8;
+    static constexpr int singularMargin = 5;
+    // Reading the clock is a system call so the main thread only does it every clockCheckNodes nodes,
+    // at about a million nodes per second that's every 2 milliseconds.
+    static constexpr int clockCheckNodes = 2048;
+    // While searching the nodes and speed are reported every infoIntervalMs and from currMoveInfoMs
+    // the root move being searched too, before that an iteration is short enough to wait for its result.
+    static constexpr int infoIntervalMs = 1000;
+    static constexpr int currMoveInfoMs = 3000;
+
     TranspositionTable* table;
     MoveOrderer moveOrderer;
+
+    // Lazy SMP, every helper thread runs its own iterative deepening on a copy of the position with its own
+    // killers and counters, they only share the transposition table and the stop flag of the main search.
+    int threadCount = 1, threadId = 0, completedDepth = 0;
+    myVector<Minimax*> helpers;
+    atomic<bool> stopFlag{ false };
+    atomic<bool>* stop = &stopFlag;
+    // The table counters of this thread, added to the table's once the search is over.
+    TableStats tableStats;
+
+    // Quiet moves that caused a beta cut-off at the same ply, they are likely to do it again in the sibling positions.
+    Move killerMoves[256][2];
+    // The move made at every ply of the line being searched, the counter moves are indexed by the previous one.
+    Move playedMoves[256];
     Move bestMove, bestMoveThisIteration;
-    int node_counter = 0, reached_depth, time_limit = 3000, least_depth = 1, Q_nodes = 0, quiescenceMaxDepth = 32;
-    int bestScore, bestScoreThisIteration, tableUses = 0, maxDepth = 255;
+    // MultiPV, every iteration first searches the best line, then the best line without the root moves of the lines
+    // found before it and so on. iterationLines are the lines of the running iteration and pvLines the ones of the last finished one.
+    // A line keeps the first MaxPvLength moves of its principal variation.
+    static constexpr int MaxPvLength = 64;
+    struct RootLine {
+        Move move;
+        int score = INT_MIN + 1;
+        Move pv[MaxPvLength];
+        int pvLength = 0;
+    };
+    RootLine pvLines[MoveList::Capacity], iterationLines[MoveList::Capacity];
+    int pvIndex = 0, lineCount = 1;
+    // Triangular PV table, pvTable[ply] holds the best line found from that ply of the line being searched
+    // (the moves from pvTable[ply][ply] to pvTable[ply][pvLength[ply] - 1]), a node builds it from its best move
+    // and the line of the child below that move.
+    Move pvTable[256][256];
+    int pvLength[256];
+    // Whether the value of the node at that ply of the line depends on the moves that led to it, which happens when a draw
+    // below it is a repetition of a position before the node or comes from the fifty move rule. When such a node gets
+    // the draw score it isn't stored in the table since the same position reached by another line could be worth something else.
+    bool historyDependent[256];
+    // The deepest ply reached in the iteration, counting quiescence search.
+    int selDepth = 0;
+    // The node count of this thread, published for the main thread which reports the nodes of all the threads.
+    atomic<long long> publishedNodes{ 0 };
+    // When the next periodic info line is sent, in milliseconds from the start of the search.
+    long long nextInfoMs = 0;
+    SearchLimits limits;
+    // ponderHit only raises ponderHitReceived from the UCI thread, the main search thread sees it at its next clock check
+    // and from then on counts the time limit from that moment (ponderHitMs after its own start time).
+    atomic<bool> ponderHitReceived{ false };
+    bool pondering = false;
+    long long ponderHitMs = 0;
+    long long node_counter = 0, Q_nodes = 0, nextClockCheck = 0;
+    int reached_depth, least_depth = 1, quiescenceMaxDepth = 32;
+    int bestScore, bestScoreThisIteration, tableUses = 0, maxDepth = 255, searchDepth = 1;
     double time_in_seconds;
     chrono::steady_clock::time_point start_time;
     chrono::milliseconds duration;
@@ -98,18 +284,41 @@ private:
     void merge(myVector<myPair<int, Move>>& leftVec, myVector<myPair<int, Move>>& rightVec, myVector<myPair<int, Move>>& vec);
     void mergeSort(myVector<myPair<int, Move>>& vec);
     void sort_moves(GameState& state);
-    bool timeLimitExceeded(chrono::steady_clock::time_point& start, chrono::milliseconds& duration, int& depth);
+    void storeKiller(Move move, int ply);
+    void updateQuietStats(GameState& state, Move bestQuiet, Move previousMove, Move* quietsTried, int quietCount, int plyRemaining, int plyFromRoot);
+    void resetSearch();
+    void search(GameState& state);
+    bool timeLimitExceeded(int depth, bool readClock = false);
     int get_pcsq_value(int x, int y, int piece, bool endgame);
-    int evaluate_pawns(int team, int white_pawns_row[], int black_pawns_row[]);
-    int minimax(GameState& state, int plyRemaining = 3, int depth = 3, int alpha = INT_MIN + 1, int beta = INT_MAX);
+    template<Color Us> int evaluate_pawns(int white_pawns_row[], int black_pawns_row[]);
+    int minimax(GameState& state, int plyRemaining, int plyFromRoot, int alpha, int beta, bool allowNullMove = true, Move excludedMove = Move());
+    int searchSamePly(GameState& state, int plyRemaining, int plyFromRoot, int alpha, int beta, Move excludedMove = Move());
+    bool hasNonPawnMaterial(GameState& state);
+    bool isRootExcluded(Move move);
+    void recordLine(RootLine& line);
+    void updatePv(Move move, int ply);
+    long long totalNodes();
+    void reportLines(int depth, int lines);
     int evaluation(GameState& state);
-    int quiescenceSearch(GameState& state, int depth, int mainSearchDepth, int alpha, int beta);
+    int quiescenceSearch(GameState& state, int plyRemaining, int plyFromRoot, int alpha, int beta);
 public:
-    void setTimeLimit(int time);
+    PruningMargins margins;
+    // How many of the best root moves are searched and reported to the GUI, more than one is only useful for analysis.
+    int multiPV = 1;
+    // Receives the info lines of the search, nothing is reported when it isn't set.
+    function<void(string)> sendInfo;
+
+    void setLimits(SearchLimits newLimits);
+    void stopSearch();
+    void ponderHit();
+    Move ponderMove(GameState& state, Move best);
+    static int mateInMoves(int score);
     Minimax(TranspositionTable& Ttable);
+    ~Minimax();
+    void setThreads(int threads);
+    void clearHistory();
     Move iterative_deepening(GameState& state);
     string displayStatistics(GameState& state);
 
 };
 
-void perftResults(GameState& state, int depth = 0, int startDepth=1);
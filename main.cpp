@@ -4,15 +4,22 @@
 #include <sstream>
 #include <string>
 #include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include "pcsq.h"
 #include "dataStructures.h"
 #include "logic.h"
+#include "perft.h"
+#include "bitboard.h"
 #include "TranspositionTable.h"
 
 using namespace std;
 
 struct Logger {
     ofstream logFile;
+    // Both the UCI thread and the search thread write to the log.
+    mutex logMutex;
     static constexpr int maxSize = 100 * 1024; // 100 KB
 
     Logger(string& filename) {
@@ -43,6 +50,7 @@ struct Logger {
     }
 
     void log(string message) {
+        lock_guard<mutex> lock(logMutex);
         if (logFile.is_open()) {
             logFile << message << endl;
         }
@@ -70,14 +78,37 @@ bool contains(string s, myVector<string>& tokens) {
     return false;
 }
 
+// Returns the number following the given token name or the default value if the token isn't there
+// or isn't followed by a number.
+long long tokenValue(string name, myVector<string>& tokens, long long defaultValue) {
+    for (int i = 0; i + 1 < tokens.size(); i++) {
+        long long value = defaultValue;
+        if (tokens[i] == name && parseNumber(tokens[i + 1], value)) return value;
+    }
+    return defaultValue;
+}
+
 struct ChessEngine {
     GameState state;
     Minimax AI;
     TranspositionTable Ttable;
     Logger logger;
+    int threads = 1, hashSizeMB;
+    static constexpr int defaultThinkTime = 3000;
+
+    // The search runs on its own thread so the UCI loop keeps answering while the engine thinks.
+    // The loop hands a search over by setting goPending and the search thread prints bestmove itself
+    // once it's done, everything shared between them is guarded by searchMutex.
+    thread searchThread;
+    mutex searchMutex, outputMutex;
+    condition_variable searchSignal;
+    bool goPending = false, searching = false, stopRequested = false, ponderHitReceived = false, quitting = false;
+    SearchLimits limits;
 
-    ChessEngine (int sizeMB, string& filename) : Ttable(sizeMB) , AI(Ttable), logger(filename){
+    ChessEngine (int sizeMB, string& filename) : Ttable(sizeMB) , AI(Ttable), logger(filename), hashSizeMB(sizeMB){
+        initBitboards();
         state.initialize_board(Ttable);
+        AI.sendInfo = [this](string line) { send(line); };
     }
 
     void positionCommand(myVector<string>& tokens) {
@@ -86,8 +117,12 @@ struct ChessEngine {
             logger.log("Initialized board to new startpos and cleared Transposition Table");
         }
         else if (contains("fen", tokens)) {
-            state.initialize_board(Ttable, tokens[2]);
-            logger.log("Initialized board to new FEN" + tokens[2]);
+            // The fen itself is split into several tokens (pieces, side, castling, en passant and the move counters).
+            string fen = "";
+            for (int i = 2; i < tokens.size() && tokens[i] != "moves"; i++)
+                fen += tokens[i] + " ";
+            state.initialize_board(Ttable, fen);
+            logger.log("Initialized board to new FEN " + fen);
         }
         else {
             cout << "Invalid command" << endl;
@@ -98,7 +133,10 @@ struct ChessEngine {
         }
 
         if (contains("moves", tokens)) {
-            for (int i = 3; i < tokens.size(); i++) {
+            int firstMove = 0;
+            while (tokens[firstMove] != "moves") firstMove++;
+
+            for (int i = firstMove + 1; i < tokens.size(); i++) {
                 state.generate_all_possible_moves(state.player);
                 myPair<int, int> from = to_index(tokens[i][0], tokens[i][1]);
                 myPair<int, int> to = to_index(tokens[i][2], tokens[i][3]);
@@ -107,7 +145,7 @@ struct ChessEngine {
 
                 if (tokens[i].size() > 4) {
                     int piece = matchPieceType(state.board, tokens[i][4]);
-                    state.board[to.first][to.second] = piece * state.player * -1;
+                    state.replacePiece(to.first, to.second, piece * state.player * -1);
                 }
             }
         }
@@ -120,74 +158,252 @@ struct ChessEngine {
         else return 4;
     }
 
+    // go [depth <plies>] [nodes <count>] [mate <moves>] [movetime <ms>] [wtime <ms> btime <ms> [winc <ms>] [binc <ms>] [movestogo <moves>]] [infinite]
+    // The tokens can come in any order, a go without any limit thinks for defaultThinkTime.
     void goCommand(myVector<string>& tokens) {
-        // Start the search
+        SearchLimits limits;
+        limits.depth = tokenValue("depth", tokens, 0);
+        limits.nodes = tokenValue("nodes", tokens, 0);
+        limits.mate = tokenValue("mate", tokens, 0);
+        limits.infinite = contains("infinite", tokens);
+        limits.ponder = contains("ponder", tokens);
 
+        // A time limit of 0 means there's none, so a given time is at least 1 ms even when it rounds down to nothing.
         if (contains("movetime", tokens)) {
-            int time = (stoi(tokens[2]) * 99) / 100;
-            AI.setTimeLimit(time);
-            string time_s = to_string(time);
-            logger.log("Thinking for: " + time_s);
+            limits.timeMs = max(1, int((tokenValue("movetime", tokens, 0) * 99) / 100));
         }
-        else {
-            int wtime = stoi(tokens[2]), btime = stoi(tokens[4]);
-            int winc = stoi(tokens[6]), binc = stoi(tokens[8]);
-            int time = chooseThinkTime(wtime, btime, winc, binc);
-            AI.setTimeLimit(time);
-            logger.log("Thinking for: " + to_string(time));
+        else if (contains("wtime", tokens) || contains("btime", tokens)) {
+            int wtime = tokenValue("wtime", tokens, 0), btime = tokenValue("btime", tokens, 0);
+            int winc = tokenValue("winc", tokens, 0), binc = tokenValue("binc", tokens, 0);
+            limits.timeMs = max(1, chooseThinkTime(wtime, btime, winc, binc, tokenValue("movestogo", tokens, 0)));
         }
+        else if (!limits.depth && !limits.nodes && !limits.mate && !limits.infinite) {
+            limits.timeMs = defaultThinkTime;
+        }
+
+        AI.setLimits(limits);
+        this->limits = limits;
+        logger.log("Thinking for: " + to_string(limits.timeMs) + " ms, depth " + to_string(limits.depth) + ", nodes " + to_string(limits.nodes));
+
+        lock_guard<mutex> lock(searchMutex);
+        goPending = true, searching = true, stopRequested = false, ponderHitReceived = false;
+        searchSignal.notify_all();
+    }
+
+    // Waits for go commands on the search thread until the engine quits.
+    void searchLoop() {
+        unique_lock<mutex> lock(searchMutex);
+        while (true) {
+            searchSignal.wait(lock, [this] { return goPending || quitting; });
+            if (quitting) return;
+            goPending = false;
+
+            lock.unlock();
+            think();
+            lock.lock();
+
+            searching = false;
+            searchSignal.notify_all();
+        }
+    }
 
+    // Runs the search handed over by goCommand on the search thread.
+    void think() {
         state.generate_all_possible_moves(state.player);
         Move move = AI.iterative_deepening(state);
-        string output = "bestmove " + to_algebraic(move.FromX(), move.FromY(), move.ToX(), move.ToY());
-        if (move.IsPromotion()) output = output + 'q';
-        cout << output << endl;
+
+        // An infinite or ponder search can't send its move before it's told to stop
+        // (or the opponent played the expected move), even if it's done.
+        if (limits.infinite || limits.ponder) {
+            unique_lock<mutex> lock(searchMutex);
+            searchSignal.wait(lock, [this] { return stopRequested || quitting || (limits.ponder && ponderHitReceived); });
+        }
+
+        string output = "bestmove " + moveToUci(move);
+        Move reply = AI.ponderMove(state, move);
+        if (reply.move != 0) output += " ponder " + moveToUci(reply);
+        send(output);
         string logs = "";
         logs += AI.displayStatistics(state);
         logs += Ttable.getFillData();
-        state.makeMove(move);
+        if (move.move != 0) state.makeMove(move);
         logger.log(output);
         logger.log(logs);
     }
 
+    // The opponent played the move we were pondering on, the search goes on with its normal time limit.
+    void ponderHitCommand() {
+        AI.ponderHit();
+        lock_guard<mutex> lock(searchMutex);
+        ponderHitReceived = true;
+        searchSignal.notify_all();
+    }
+
+    void stopCommand() {
+        AI.stopSearch();
+        lock_guard<mutex> lock(searchMutex);
+        stopRequested = true;
+        searchSignal.notify_all();
+    }
+
+    // The commands that change the position or the engine's settings wait until the search is over.
+    void waitForSearch() {
+        unique_lock<mutex> lock(searchMutex);
+        searchSignal.wait(lock, [this] { return !searching; });
+    }
+
+    // Both threads print so the lines are written whole.
+    void send(string line) {
+        lock_guard<mutex> lock(outputMutex);
+        cout << line << endl;
+    }
+
+    // setoption name <name> [value <value>], the name and the value can both contain spaces.
+    void setOptionCommand(myVector<string>& tokens) {
+        string name = "", value = "";
+        string* current = nullptr;
+        for (int i = 1; i < tokens.size(); i++) {
+            if (tokens[i] == "name") current = &name;
+            else if (tokens[i] == "value") current = &value;
+            else if (current) *current += (current->empty() ? "" : " ") + tokens[i];
+        }
+
+        // The spin options need a number, a value that isn't one is ignored.
+        long long number = 0;
+        bool spinOption = name == "Threads" || name == "Hash" || name == "MultiPV" || name.find("Margin") != string::npos;
+        if (spinOption && !parseNumber(value, number)) {
+            logger.log("Invalid value for " + name + ": " + value);
+            return;
+        }
+
+        if (name == "Threads") {
+            threads = int(min(max(number, 1LL), 256LL));
+            AI.setThreads(threads);
+            logger.log("Searching with " + to_string(threads) + " threads");
+        }
+        else if (name == "Hash") {
+            hashSizeMB = int(min(max(number, 1LL), 65536LL));
+            Ttable.resize(hashSizeMB);
+            logger.log("Resized the transposition table to " + to_string(hashSizeMB) + " MB");
+        }
+        else if (name == "Reverse Futility Margin") AI.margins.reverseFutility = int(min(max(number, 0LL), 1000LL));
+        else if (name == "Futility Margin") AI.margins.futility = int(min(max(number, 0LL), 1000LL));
+        else if (name == "Razoring Margin") AI.margins.razoring = int(min(max(number, 0LL), 1000LL));
+        else if (name == "Delta Margin") AI.margins.delta = int(min(max(number, 0LL), 2000LL));
+        else if (name == "MultiPV") AI.multiPV = int(min(max(number, 1LL), (long long)MoveList::Capacity));
+        else if (name == "Ponder") {
+            // Nothing to set up, the GUI decides when to send go ponder.
+            logger.log("Pondering " + string(value == "true" ? "enabled" : "disabled"));
+        }
+        else if (name == "Clear Hash") {
+            Ttable.clear(threads);
+            logger.log("Cleared the transposition table");
+        }
+        else {
+            logger.log("Unknown option: " + name);
+        }
+    }
+
+    // perft <depth> | divide <depth> | perft suite, optionally followed by "threads <count>" and "hash <MB>".
+    // The perft hash is off unless a size is given so the node rate measures the move generator alone.
+    void perftCommand(myVector<string>& tokens) {
+        int threads = tokenValue("threads", tokens, max(1, (int)thread::hardware_concurrency()));
+        int hashMB = tokenValue("hash", tokens, 0);
+        PerftTable* hash = (hashMB > 0) ? new PerftTable(hashMB) : nullptr;
+
+        if (tokens.size() > 1 && tokens[1] == "suite") {
+            perftSuite(Ttable, threads, hash, cout);
+        }
+        else {
+            int depth = tokenValue(tokens[0], tokens, 1);
+            PerftResult result = perftRoot(state, depth, threads, hash, tokens[0] == "divide", cout);
+            cout << endl << "Nodes searched: " << result.nodes << endl;
+            cout << "Time: " << result.timeMs << " ms, " << result.nps() << " nps" << endl;
+            logger.log("Perft depth " + to_string(depth) + ": " + to_string(result.nodes) + " nodes");
+        }
+
+        delete hash;
+    }
+
     void uciLoop() {
+        searchThread = thread([this] { searchLoop(); });
+
         string input;
         while (getline(cin, input)) {
             logger.log("Recieved command: " + input);
             myVector<string> tokens = split(input, ' ');
+            if (tokens.empty()) continue;
+
+            if (tokens[0] == "stop") {
+                stopCommand();
+                continue;
+            }
+            if (tokens[0] == "ponderhit") {
+                ponderHitCommand();
+                continue;
+            }
+            if (tokens[0] == "isready") {
+                logger.log("Response: readyok");
+                send("readyok");
+                continue;
+            }
+            if (input == "quit") break;
+
+            // The rest of the commands aren't allowed during a search.
+            waitForSearch();
+
             if (tokens[0] == "uci") {
                 cout << "id name TheShadowEngine" << endl;
                 cout << "id author Ismail Gamal" << endl;
+                cout << "option name Hash type spin default " << hashSizeMB << " min 1 max 65536" << endl;
+                cout << "option name Clear Hash type button" << endl;
+                cout << "option name Threads type spin default 1 min 1 max 256" << endl;
+                cout << "option name Ponder type check default false" << endl;
+                cout << "option name MultiPV type spin default 1 min 1 max " << MoveList::Capacity << endl;
+                PruningMargins defaults;
+                cout << "option name Reverse Futility Margin type spin default " << defaults.reverseFutility << " min 0 max 1000" << endl;
+                cout << "option name Futility Margin type spin default " << defaults.futility << " min 0 max 1000" << endl;
+                cout << "option name Razoring Margin type spin default " << defaults.razoring << " min 0 max 1000" << endl;
+                cout << "option name Delta Margin type spin default " << defaults.delta << " min 0 max 2000" << endl;
                 cout << "uciok" << endl;
                 logger.log("Response: uciok" );
             }
-            else if (tokens[0] == "isready"){
-                logger.log("Response: readyok");
-                cout << "readyok" << endl;
-            }
             else if (tokens[0] == "ucinewgame") {
-                Ttable.clear();
+                Ttable.clear(threads);
+                AI.clearHistory();
                 state.initialize_board(Ttable);
             }
+            else if (tokens[0] == "setoption") {
+                setOptionCommand(tokens);
+            }
             else if (tokens[0] == "position") {
                 positionCommand(tokens);
             }
             else if (tokens[0] == "go") {
                 goCommand(tokens);
             }
-            else if (input == "quit") {
-                break;
+            else if (tokens[0] == "perft" || tokens[0] == "divide") {
+                perftCommand(tokens);
             }
         }
+
+        stopCommand();
+        {
+            lock_guard<mutex> lock(searchMutex);
+            quitting = true;
+            searchSignal.notify_all();
+        }
+        searchThread.join();
     }
 
-    int chooseThinkTime(int timeRemainingWhiteMs, int timeRemainingBlackMs, int incrementWhiteMs, int incrementBlackMs) {
+    int chooseThinkTime(int timeRemainingWhiteMs, int timeRemainingBlackMs, int incrementWhiteMs, int incrementBlackMs, int movesToGo = 0) {
         int myTimeRemainingMs = (state.player == 1) ? timeRemainingWhiteMs : timeRemainingBlackMs;
         int myIncrementMs = (state.player == 1) ? incrementWhiteMs : incrementBlackMs;
 
         // Get a fraction of remaining time to use for current move
-        // this should smooth the time usage.
-        int thinkTimeMs = myTimeRemainingMs / 40;
+        // this should smooth the time usage, with a move count to the next time control
+        // the time is split over those moves (and one more to keep some time in reserve).
+        int thinkTimeMs = myTimeRemainingMs / ((movesToGo > 0) ? min(movesToGo + 1, 40) : 40);
 
         if (myTimeRemainingMs > myIncrementMs * 2)
         {
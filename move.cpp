@@ -52,102 +52,74 @@ bool Move::IsCapture() {
 }
 
 
-void MoveOrderer::merge(myVector<Move>& leftVec, myVector<Move>& rightVec, myVector<Move>& vec) {
-    int left = 0, right = 0;
-    vec.clear();
+// Scores a move using MVV-LVA heuristic (Most valuable victim-Least valuavle aggressor).
+int MoveOrderer::scoreMove(Move& move, int board[8][8]) {
+    int moveScore = 0;
+    int capturedPiece = abs(board[move.ToX()][move.ToY()]);
+    int movingPiece = abs(board[move.FromX()][move.FromY()]);
 
-    while (left < leftVec.size() && right < rightVec.size()) {
-        if (leftVec[left].moveOrderingValue > rightVec[right].moveOrderingValue) {
-            vec.push_back(leftVec[left++]);
-        }
-        else {
-            vec.push_back(rightVec[right++]);
-        }
-    }
+    // The pawn taken by an en passant isn't standing on the target square.
+    if (move.IsEnPassant()) capturedPiece = 6;
 
-    while (left < leftVec.size()) {
-        vec.push_back(leftVec[left++]);
+    if (move.IsCapture()) {
+        moveScore = 10 * pieceOrderValue[capturedPiece] - pieceOrderValue[movingPiece];
     }
 
-    while (right < rightVec.size()) {
-        vec.push_back(rightVec[right++]);
+    if (move.IsPromotion()) {
+        moveScore += pieceOrderValue[movingPiece];
     }
-}
-
-
-// Implements mergeSort to sort the moves in increasing order.
-// move oredering is important as we explore the best moves from the previous search depth
-// first which helps us prune more branches early on.
-void MoveOrderer::mergeSort(myVector<Move>& vec) {
-    size_t size = vec.size();
-    if (size <= 1) return;
-
-    int mid = size / 2;
 
-    myVector<Move> leftVec;
-    myVector<Move> rightVec;
-
-    for (int i = 0; i < mid; i++) {
-        leftVec.push_back(vec[i]);
-    }
-    for (int i = mid; i < size; i++) {
-        rightVec.push_back(vec[i]);
-    }
-
-    mergeSort(leftVec);
-    mergeSort(rightVec);
-
-    merge(leftVec, rightVec, vec);
+    return moveScore;
 }
 
-int partition(myVector<Move>& arr, int left, int right) {
-    int i = left - 1;
-    int pivotScore = arr[right].moveOrderingValue;
+// Captures are scored by MVV-LVA alone, the quiet moves of a side (team isn't 0) by their history
+// with promotions going first and a small bonus for the counter move of the opponent's last move.
+void MoveOrderer::scoreMoves(MoveList& moves, int board[8][8], int team, Move counterMove) {
+    for (int i = 0; i < moves.size(); i++) {
+        moves.scores[i] = scoreMove(moves[i], board);
+
+        if (team != 0 && !moves[i].IsCapture()) {
+            if (moves[i].IsPromotion()) moves.scores[i] = 3 * HistoryMax;
+            else {
+                moves.scores[i] = historyScore(team, moves[i]);
+                if (moves[i].move == counterMove.move) moves.scores[i] += CounterMoveBonus;
+            }
+        }
 
-    for (int j = left; j <= right; j++) {
-        if (arr[j].moveOrderingValue> pivotScore) {
-            i++;
-            Move temp = arr[i];
-            arr[i] = arr[j];
-            arr[j] = temp;
+        if (noiseSeed && !moves[i].IsCapture() && !moves[i].IsPromotion()) {
+            noiseSeed ^= noiseSeed << 13;
+            noiseSeed ^= noiseSeed >> 17;
+            noiseSeed ^= noiseSeed << 5;
+            moves.scores[i] += noiseSeed & 7;
         }
     }
-    i++;
-    Move temp = arr[right];
-    arr[right] = arr[i];
-    arr[i] = temp;
-
-    return i;
 }
 
-// Sorts using quicksort which have proven to be much faster than mergesort in practice
-// mostly due to sorting in place instead of copying.
-void quickSort(myVector<Move>& arr, int left, int right) {
-    if (left >= right) return;
-
-    int pivotIndex = partition(arr, left, right);
-    quickSort(arr, left, pivotIndex - 1);
-    quickSort(arr, pivotIndex + 1, right);
+int MoveOrderer::historyScore(int team, Move move) {
+    return history[colorIndex(team)][square(move.FromX(), move.FromY())][square(move.ToX(), move.ToY())];
 }
 
-// Sorting the moves using MVV-LVA heuristic (Most valuable victim-Least valuavle aggressor).
-void MoveOrderer::sortMoves(myVector<Move>& moves, int board[8][8]) {
-    for (int i = 0; i < moves.size(); i++) {
-        uint16_t moveScore = 0;
-        int capturedPiece = abs(board[moves[i].ToX()][moves[i].ToY()]);
-        int movingPiece = abs(board[moves[i].FromX()][moves[i].FromY()]);
-
-        if (moves[i].IsCapture()) {
-            moveScore = 10 * pieceOrderValue[capturedPiece] - pieceOrderValue[movingPiece];
-        }
-
-        if (moves[i].IsPromotion()) {
-            moveScore += pieceOrderValue[movingPiece];
-        }
+// History gravity, the bonus (or the malus when it's negative) shrinks the closer the score
+// already is to HistoryMax in that direction so the scores saturate and old results fade out.
+void MoveOrderer::updateHistory(int team, Move move, int bonus) {
+    int& entry = history[colorIndex(team)][square(move.FromX(), move.FromY())][square(move.ToX(), move.ToY())];
+    entry += bonus - entry * abs(bonus) / HistoryMax;
+}
 
-        moves[i].moveOrderingValue = moveScore;
-    }
+// Halves the history at the start of every search so the moves that are good in the current position
+// quickly take over from the ones that were good a few moves ago.
+void MoveOrderer::ageHistory() {
+    for (int side = 0; side < 2; side++)
+        for (int from = 0; from < 64; from++)
+            for (int to = 0; to < 64; to++)
+                history[side][from][to] /= 2;
+}
 
-    quickSort(moves, 0, moves.size() - 1);
-    //mergeSort(moves);
-}
\ No newline at end of file
+void MoveOrderer::clearHistory() {
+    for (int side = 0; side < 2; side++)
+        for (int from = 0; from < 64; from++)
+            for (int to = 0; to < 64; to++) {
+                history[side][from][to] = 0;
+                counterMoves[from][to] = Move();
+            }
+}
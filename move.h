@@ -1,6 +1,7 @@
 #pragma once
 #include <iostream>
 #include "dataStructures.h"
+#include "bitboard.h"
 
 struct Move {
     static constexpr uint16_t None = 0;
@@ -16,7 +17,6 @@ struct Move {
     // The flag can be any of the static constexpr above essentially 
     // flagging the move as any of the special moves and the last bit stores if it's a capture or not.
     uint16_t move = 0;
-    uint16_t moveOrderingValue = 0;
 
     Move(int fromX, int fromY, int toX, int toY, int flag = 0, bool capture = false);
     Move();
@@ -32,10 +32,70 @@ struct Move {
     bool IsCapture();
 };
 
+// A fixed size list of moves that lives on the stack of the search so generating moves never allocates,
+// no position has more than 218 legal moves. The ordering score of every move is kept in a
+// parallel array so the moves themselves stay 16 bits.
+struct MoveList {
+    static constexpr int Capacity = 256;
+
+    Move moves[Capacity];
+    int scores[Capacity];
+    int count = 0;
+
+    void push_back(Move move) {
+        moves[count++] = move;
+    }
+
+    int size() {
+        return count;
+    }
+
+    bool empty() {
+        return count == 0;
+    }
+
+    void clear() {
+        count = 0;
+    }
+
+    void swap(int i, int j) {
+        Move tempMove = moves[i];
+        moves[i] = moves[j];
+        moves[j] = tempMove;
+
+        int tempScore = scores[i];
+        scores[i] = scores[j];
+        scores[j] = tempScore;
+    }
+
+    Move& operator[](int index) {
+        return moves[index];
+    }
+};
+
 struct MoveOrderer {
     static constexpr uint16_t pieceOrderValue[] = {0, 0, 9, 5, 3, 3, 1};
 
-    void merge(myVector<Move>& leftVec, myVector<Move>& rightVec, myVector<Move>& vec);
-    void mergeSort(myVector<Move>& vec);
-    void sortMoves(myVector<Move>& moves, int board[8][8]);
+    // The helper search threads shuffle the order of the quiet moves with the same score
+    // so they don't all walk the same tree, it stays 0 (no shuffling) for the main thread.
+    uint32_t noiseSeed = 0;
+
+    // The history scores never go beyond +-HistoryMax so quiet promotions are scored above it.
+    static constexpr int HistoryMax = 16384;
+    // Only a small nudge, it mostly puts the counter move ahead of the moves that have no history yet
+    // since giving it more weight than a good history made the search bigger in testing.
+    static constexpr int CounterMoveBonus = 128;
+
+    // Butterfly history, how often a quiet move of a side from a square to a square caused a cut-off
+    // and how deep, minus how often it failed to when another move did.
+    int history[2][64][64] = {};
+    // The quiet move that last refuted a move, indexed by the from and to squares of the move it answered.
+    Move counterMoves[64][64];
+
+    int scoreMove(Move& move, int board[8][8]);
+    void scoreMoves(MoveList& moves, int board[8][8], int team = 0, Move counterMove = Move());
+    int historyScore(int team, Move move);
+    void updateHistory(int team, Move move, int bonus);
+    void ageHistory();
+    void clearHistory();
 };
\ No newline at end of file
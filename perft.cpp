@@ -0,0 +1,155 @@
+#pragma once
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "perft.h"
+
+using namespace std;
+
+// The engine only generates queen promotions, so the depths were picked where no
+// underpromotion happens in the tree and the published node counts still apply.
+struct PerftPosition {
+    const char* name;
+    const char* fen;
+    int depth;
+    uint64_t expected;
+};
+
+static const PerftPosition perftPositions[] = {
+    { "startpos", "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", 5, 4865609 },
+    { "kiwipete", "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1", 3, 97862 },
+    { "position 3", "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1", 5, 674624 },
+    { "position 6", "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10", 4, 3894594 },
+    { "short castling", "5k2/8/8/8/8/8/8/4K2R w K - 0 1", 6, 661072 },
+    { "long castling", "3k4/8/8/8/8/8/8/R3K3 w Q - 0 1", 6, 803711 },
+    { "castling rights", "r3k2r/1b4bq/8/8/8/8/7B/R3K2R w KQkq - 0 1", 4, 1274206 },
+    { "castling prevented", "r3k2r/8/3Q4/8/8/5q2/8/R3K2R b KQkq - 0 1", 4, 1720476 },
+    { "double check", "8/8/2k5/5q2/5n2/8/5K2/8 b - - 0 1", 4, 23527 },
+};
+
+PerftTable::PerftTable(int sizeMB) {
+    // Rounded down to a power of two so the index is just the low bits of the key.
+    uint64_t count = 1;
+    while (count * 2 * sizeof(Entry) <= uint64_t(sizeMB) * 1024 * 1024) count *= 2;
+    entries = new Entry[count];
+    mask = count - 1;
+}
+
+PerftTable::~PerftTable() {
+    delete[] entries;
+}
+
+// The depth is mixed into the key since the same position is counted at different depths.
+static uint64_t perftKey(uint64_t key, int depth) {
+    return key ^ (uint64_t(depth) * 0x9E3779B97F4A7C15ULL);
+}
+
+bool PerftTable::probe(uint64_t key, int depth, uint64_t& nodes) {
+    uint64_t hashKey = perftKey(key, depth);
+    Entry& entry = entries[hashKey & mask];
+    uint64_t storedNodes = entry.nodes.load(memory_order_relaxed);
+    if ((entry.check.load(memory_order_relaxed) ^ storedNodes) != hashKey) return false;
+    nodes = storedNodes;
+    return true;
+}
+
+void PerftTable::store(uint64_t key, int depth, uint64_t nodes) {
+    uint64_t hashKey = perftKey(key, depth);
+    Entry& entry = entries[hashKey & mask];
+    entry.check.store(hashKey ^ nodes, memory_order_relaxed);
+    entry.nodes.store(nodes, memory_order_relaxed);
+}
+
+uint64_t PerftResult::nps() {
+    return nodes * 1000 / max(timeMs, 1LL);
+}
+
+uint64_t perft(GameState& state, int depth, PerftTable* hash) {
+    if (depth == 0) return 1;
+
+    uint64_t nodes = 0;
+    if (hash && depth > 1 && hash->probe(state.zobristKey, depth, nodes)) return nodes;
+
+    MoveList moves;
+    state.generate_moves(moves);
+
+    // Bulk counting, every legal move at the last ply is exactly one leaf so they don't need to be made.
+    if (depth == 1) return moves.size();
+
+    for (int i = 0; i < moves.size(); i++) {
+        state.makeMove(moves[i]);
+        nodes += perft(state, depth - 1, hash);
+        state.unMakeMove(moves[i]);
+    }
+
+    if (hash) hash->store(state.zobristKey, depth, nodes);
+    return nodes;
+}
+
+PerftResult perftRoot(GameState& state, int depth, int threads, PerftTable* hash, bool divide, ostream& out) {
+    PerftResult result;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    MoveList rootMoves;
+    state.generate_moves(rootMoves);
+    uint64_t rootNodes[MoveList::Capacity] = {};
+
+    // The workers take the next root move that nobody counted yet until all of them are done,
+    // every worker has its own copy of the position and they only share the perft table.
+    atomic<int> nextMove{ 0 };
+    auto worker = [&]() {
+        GameState local = state;
+        int i;
+        while ((i = nextMove.fetch_add(1)) < rootMoves.size()) {
+            if (depth <= 1) { rootNodes[i] = 1; continue; }
+            local.makeMove(rootMoves[i]);
+            rootNodes[i] = perft(local, depth - 1, hash);
+            local.unMakeMove(rootMoves[i]);
+        }
+    };
+
+    if (depth > 0) {
+        vector<thread> pool;
+        for (int t = 0; t < max(threads, 1); t++)
+            pool.emplace_back(worker);
+        for (thread& t : pool)
+            t.join();
+    }
+
+    for (int i = 0; i < rootMoves.size(); i++) {
+        if (divide) out << moveToUci(rootMoves[i]) << ": " << rootNodes[i] << endl;
+        result.nodes += rootNodes[i];
+    }
+    if (depth == 0) result.nodes = 1;
+
+    result.timeMs = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count();
+    return result;
+}
+
+bool perftSuite(TranspositionTable& Ttable, int threads, PerftTable* hash, ostream& out) {
+    uint64_t totalNodes = 0;
+    long long totalTime = 0;
+    int failed = 0;
+
+    for (const PerftPosition& position : perftPositions) {
+        GameState state;
+        state.initialize_board(Ttable, position.fen);
+
+        PerftResult result = perftRoot(state, position.depth, threads, hash, false, out);
+        bool passed = result.nodes == position.expected;
+        if (!passed) failed++;
+        totalNodes += result.nodes;
+        totalTime += result.timeMs;
+
+        out << position.name << " depth " << position.depth << ": " << result.nodes << " nodes (expected " << position.expected << ") "
+            << result.timeMs << " ms " << result.nps() << " nps " << (passed ? "OK" : "FAILED") << endl;
+    }
+
+    PerftResult total;
+    total.nodes = totalNodes;
+    total.timeMs = totalTime;
+    out << "Total: " << totalNodes << " nodes " << totalTime << " ms " << total.nps() << " nps" << endl;
+    if (failed) out << failed << " positions FAILED" << endl;
+    else out << "All positions passed" << endl;
+    return failed == 0;
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <iostream>
+#include <atomic>
+#include <string>
+#include "dataStructures.h"
+#include "logic.h"
+
+using namespace std;
+
+// Perft counts the leaf nodes of the legal move tree to a fixed depth, comparing the counts with
+// known results is how we check the move generator and timing it measures its speed.
+
+// Remembers the node count of positions already counted at a given depth, transpositions are common
+// deep in the tree so a lot of subtrees don't have to be walked again.
+// Every entry is two 64 bit words, the key is stored xored with the count so an entry torn
+// by two threads writing it at the same time won't match any key and is just ignored.
+struct PerftTable {
+    struct Entry {
+        atomic<uint64_t> check{ 0 };
+        atomic<uint64_t> nodes{ 0 };
+    };
+
+    Entry* entries = nullptr;
+    uint64_t mask = 0;
+
+    PerftTable(int sizeMB);
+    ~PerftTable();
+    bool probe(uint64_t key, int depth, uint64_t& nodes);
+    void store(uint64_t key, int depth, uint64_t nodes);
+};
+
+struct PerftResult {
+    uint64_t nodes = 0;
+    long long timeMs = 0;
+    uint64_t nps();
+};
+
+uint64_t perft(GameState& state, int depth, PerftTable* hash = nullptr);
+// Splits the root moves between the threads and reports the nodes under every root move when divide is set.
+PerftResult perftRoot(GameState& state, int depth, int threads, PerftTable* hash, bool divide, ostream& out);
+// Runs the standard positions and reports every mismatch, returns false if any count was wrong.
+bool perftSuite(TranspositionTable& Ttable, int threads, PerftTable* hash, ostream& out);